@@ -0,0 +1,56 @@
+///
+/// \file
+///
+/// \brief Run-time benchmark for parallel dynamic batteries.
+///
+/// Calls a <code>dynamic_battery</code> of simple threshold rules,
+/// at a few battery sizes, serially and in parallel chunks of a few
+/// grains, and prints the time per call. Parallel chunks only pay off
+/// once a chunk takes well more than the cost of handing it to
+/// another thread, which is what picks the default grain. Pass a
+/// number of threads to use other than <code>max_threads()</code>.
+///
+#include "funtup.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+
+struct above { int t; bool operator()(int a) const { return a > t; } };
+
+template<typename Battery>
+double micros_per_call(const Battery& b, std::size_t n) {
+  std::vector<char> fired;
+  std::size_t check = 0;
+  const int calls = int(std::max<std::size_t>(20, (std::size_t(1) << 24) / n));
+  for (int i = 0; i < calls / 10; ++i) { b.call_into(fired, i); }
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; ++i) {
+    b.call_into(fired, int(i % n));
+    check += fired[0];
+  }
+  const auto end = std::chrono::steady_clock::now();
+  return check > std::size_t(calls) ? -1 : std::chrono::duration<double, std::micro>(end - start).count() / calls;
+}
+
+int main(int argc, char** argv) {
+  using namespace com_masaers::funtup;
+  const std::size_t threads = argc > 1 ? std::size_t(std::atoi(argv[1])) : max_threads();
+  std::printf("%zu threads\n%10s %10s", threads, "rules", "serial");
+  const std::size_t grains[] = { 4096, 16384, 65536 };
+  for (std::size_t grain : grains) { std::printf(" %8zu", grain); }
+  std::printf("   (us per call)\n");
+  for (std::size_t n : { 10000, 100000, 1000000 }) {
+    std::vector<above> rules;
+    for (std::size_t i = 0; i < n; ++i) { rules.push_back(above{ int(i) }); }
+    std::printf("%10zu", n);
+    max_threads() = 1;
+    std::printf(" %10.1f", micros_per_call(dynamic_battery(rules), n));
+    max_threads() = threads;
+    for (std::size_t grain : grains) {
+      std::printf(" %8.1f", micros_per_call(dynamic_battery(rules, grain), n));
+    }
+    std::printf("\n");
+  }
+  return 0;
+}
@@ -9,8 +9,18 @@
 /// \author Markus Saers
 ///
 #include <tuple>
+#include <array>
+#include <vector>
+#include <bitset>
+#include <new>
 #include <type_traits>
 #include <functional>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <chrono>
 
 namespace com_masaers {
 ///
@@ -41,6 +51,71 @@ namespace funtup {
   ///
   struct void_t {};
 
+  ///
+  /// A value that may or may not be there, such as the result of a
+  /// function that may or may not have been called.
+  ///
+  template<typename T>
+  class maybe_t {
+  public:
+    inline maybe_t() : set_m(false) {}
+    inline maybe_t(const maybe_t& x) : set_m(false) {
+      if (x.set_m) { emplace(*x); }
+    }
+    inline maybe_t(maybe_t&& x) : set_m(false) {
+      if (x.set_m) { emplace(std::move(*x)); }
+    }
+    inline ~maybe_t() { reset(); }
+    inline maybe_t& operator=(const maybe_t& x) {
+      if (! x.set_m) {
+        reset();
+      } else if (set_m) {
+        **this = *x;
+      } else {
+        emplace(*x);
+      }
+      return *this;
+    }
+    inline maybe_t& operator=(maybe_t&& x) {
+      if (! x.set_m) {
+        reset();
+      } else if (set_m) {
+        **this = std::move(*x);
+      } else {
+        emplace(std::move(*x));
+      }
+      return *this;
+    }
+    ///
+    /// Constructs a value in place, replacing any previous value.
+    ///
+    template<typename... Args>
+    inline T& emplace(Args&&... args) {
+      reset();
+      ::new (static_cast<void*>(&storage_m)) T(std::forward<Args>(args)...);
+      set_m = true;
+      return **this;
+    }
+    ///
+    /// Destroys the value, if there is one.
+    ///
+    inline void reset() {
+      if (set_m) {
+        (**this).~T();
+        set_m = false;
+      }
+    }
+    inline bool has_value() const { return set_m; }
+    inline explicit operator bool() const { return set_m; }
+    inline T& operator*() { return *reinterpret_cast<T*>(&storage_m); }
+    inline const T& operator*() const { return *reinterpret_cast<const T*>(&storage_m); }
+    inline T* operator->() { return &**this; }
+    inline const T* operator->() const { return &**this; }
+  private:
+    typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage_m;
+    bool set_m;
+  }; // maybe_t
+
   ///
   /// \name Meta functions to represent and generate sequences of indices
   ///
@@ -149,99 +224,338 @@ namespace funtup {
       return std::make_tuple(_apply_novoid(std::get<I>(funcs), std::forward<Args>(args)...)...);
     }
     ///
-    /// \name Piped function object
+    /// Function that applies the functions in a tuple whose bit is
+    /// set in the mask to the other parameters, and stores the
+    /// results in a tuple of <code>maybe_t</code>. The functions are
+    /// called in order, and a skipped function costs one bit test.
+    ///
+    template<typename Funcs, typename Results, int... I, typename... Args>
+    inline void _apply_tuple_masked(const Funcs& funcs,
+                                    Results& results,
+                                    const std::bitset<sizeof...(I)>& mask,
+                                    seq<I...> funcs_s,
+                                    Args&... args) {
+      const int expand[] = { 0, (mask[I] ? (std::get<I>(results).emplace(_apply_novoid(std::get<I>(funcs), args...)), 0) : 0)... };
+      (void)expand;
+    }
+    ///
+    /// Stores the result of applying a function to the other
+    /// parameters in existing storage.
+    ///
+    /// This version applies to functions that know how to write their
+    /// result into existing storage themselves, through a
+    /// <code>call_into(result, args...)</code> member (batteries do),
+    /// which lets them reuse whatever capacity the storage already has.
+    ///
+    template<typename Func, typename Result, typename... Args>
+    inline auto _apply_into(const Func& func, Result& result, int, Args&... args)
+      -> decltype(func.call_into(result, args...), void()) {
+      func.call_into(result, args...);
+    }
+    ///
+    /// Stores the result of applying a function to the other
+    /// parameters in existing storage.
+    ///
+    /// This version assigns the returned value to the storage.
+    ///
+    template<typename Func, typename Result, typename... Args>
+    inline void _apply_into(const Func& func, Result& result, long, Args&... args) {
+      result = _apply_novoid(func, args...);
+    }
+    ///
+    /// Function that applies a tuple of functions to the other
+    /// parameters and stores the results in an existing tuple.
+    ///
+    template<typename Funcs, typename Results, int... I, typename... Args>
+    inline void _apply_tuple_into(const Funcs& funcs,
+                                  Results& results,
+                                  seq<I...> funcs_s,
+                                  Args&... args) {
+      const int expand[] = { 0, (_apply_into(std::get<I>(funcs), std::get<I>(results), 0, args...), 0)... };
+      (void)expand;
+    }
+    ///
+    /// \name Compact result tuples
     ///
-    /// Handles all the messiness of dealing with piped functions.
+    /// Results with the <code>void_t</code> entries taken out, along
+    /// with the map from the position of a member in the battery to
+    /// the position of its result in the compact tuple.
     ///
     /// \{
     // ---------------------------------------------------------------------- //
     ///
     /// Declaration.
     ///
-    template<typename... Funcs> class pipe_t;
+    template<typename Kept, int I, typename... Results> struct kept_seq;
     ///
     /// Base case.
     ///
-    template<typename Head>
-    class pipe_t<Head> {
-    public:
-      inline pipe_t(Head&& head) : head_m(std::forward<Head>(head)) {}
-      template<typename... Args>
-      inline typename std::result_of<Head(Args&&...)>::type
-      operator()(Args&&... args) const {
-	return head_m(std::forward<Args>(args)...);
-      }
-    private:
-      Head head_m;
-    }; // pipe_t<Head>
+    template<int... J, int I>
+    struct kept_seq<seq<J...>, I> {
+      typedef seq<J...> type;
+    };
+    ///
+    /// Inductive case: keep a result.
+    ///
+    template<int... J, int I, typename Result, typename... Results>
+    struct kept_seq<seq<J...>, I, Result, Results...>
+      : public kept_seq<seq<J..., I>, I + 1, Results...>
+    {};
+    ///
+    /// Inductive case: drop a <code>void_t</code>.
+    ///
+    template<int... J, int I, typename... Results>
+    struct kept_seq<seq<J...>, I, void_t, Results...>
+      : public kept_seq<seq<J...>, I + 1, Results...>
+    {};
+    ///
+    /// Declaration.
+    ///
+    template<int I, int P, typename Kept> struct kept_position;
+    ///
+    /// Base case: member <code>I</code> was dropped.
+    ///
+    template<int I, int P>
+    struct kept_position<I, P, seq<> > {
+      static_assert(I < 0, "the member returns void and has no result");
+    };
+    ///
+    /// Base case: member <code>I</code> is found at position <code>P</code>.
+    ///
+    template<int I, int P, int... Js>
+    struct kept_position<I, P, seq<I, Js...> > : public std::integral_constant<int, P> {};
     ///
     /// Inductive case.
     ///
-    template<typename Head, typename... Tails>
-    class pipe_t<Head, Tails...> : public pipe_t<Tails...> {
+    template<int I, int P, int J, int... Js>
+    struct kept_position<I, P, seq<J, Js...> > : public kept_position<I, P + 1, seq<Js...> > {};
+    ///
+    /// Declaration.
+    ///
+    template<typename Kept, typename Results> class compact_tuple_t;
+    ///
+    /// A tuple of the results in <code>Results</code> at the indices
+    /// in <code>Kept</code>.
+    ///
+    template<int... J, typename... Results>
+    class compact_tuple_t<seq<J...>, std::tuple<Results...> >
+      : public std::tuple<typename std::tuple_element<J, std::tuple<Results...> >::type...>
+    {
     public:
-      inline pipe_t(Head&& head, Tails&&... tails)
-	: pipe_t<Tails...>(std::forward<Tails>(tails)...)
-	, head_m(std::forward<Head>(head))
+      typedef std::tuple<typename std::tuple_element<J, std::tuple<Results...> >::type...> tuple_type;
+      ///
+      /// The position in the compact tuple of the result of member
+      /// <code>I</code>.
+      ///
+      template<int I>
+      struct position : public kept_position<I, 0, seq<J...> > {};
+      inline compact_tuple_t(std::tuple<Results...>&& results)
+        : tuple_type(std::move(std::get<J>(results))...)
       {}
-      template<typename... Args>
-      inline typename std::result_of<pipe_t<Tails...>(typename std::result_of<Head(Args&&...)>::type)>::type
-      operator()(Args&&... args) const {
-	return pipe_t<Tails...>::operator()(head_m(std::forward<Args>(args)...));
-      }
-    private:
-      Head head_m;
-    }; // pipe_t<Head, Tails...>
+    }; // compact_tuple_t
     // ---------------------------------------------------------------------- //
     /// \}
 
 
     ///
-    /// \name Composed function object
+    /// \name Flat storage for a sequence of functions
     ///
-    /// Handles all the messiness of dealing with composed functions.
+    /// Each function is held in its own base class tagged with its
+    /// index, so accessing any one of them is a single conversion to
+    /// a base class, rather than a walk through nested types as with
+    /// <code>std::tuple</code>. This keeps long pipes cheap to compile.
     ///
     /// \{
     // ---------------------------------------------------------------------- //
     ///
+    /// Meta function that determines whether a stage can be held as
+    /// an empty base class, so that it takes up no space.
+    ///
+    template<typename Func>
+    struct empty_stage : public std::integral_constant<bool, std::is_empty<Func>::value && ! std::is_const<Func>::value
+#if defined(__GNUC__)
+                                                       && ! __is_final(Func)
+#endif
+                                                       > {};
+    ///
+    /// Holds the function at index <code>I</code>.
+    ///
+    template<int I, typename Func, bool Empty = empty_stage<Func>::value>
+    struct stage_t {
+      inline stage_t(Func&& func) : func_m(std::forward<Func>(func)) {}
+      inline Func& func() { return func_m; }
+      inline const Func& func() const { return func_m; }
+      Func func_m;
+    }; // stage_t
+    ///
+    /// Holds an empty function at index <code>I</code> as a base
+    /// class, which takes up no space (e.g. a <code>fn_t</code>).
+    ///
+    template<int I, typename Func>
+    struct stage_t<I, Func, true> : private Func {
+      inline stage_t(Func&& func) : Func(std::forward<Func>(func)) {}
+      inline Func& func() { return *this; }
+      inline const Func& func() const { return *this; }
+    }; // stage_t<I, Func, true>
+    ///
     /// Declaration.
     ///
-    template<typename... Funcs> class compose_t;
+    template<typename Seq, typename... Funcs> struct stages_t;
     ///
-    /// Base case
+    /// Holds all the functions, one base class per function.
+    ///
+    template<int... I, typename... Funcs>
+    struct stages_t<seq<I...>, Funcs...> : public stage_t<I, Funcs>... {
+      inline stages_t(Funcs&&... funcs)
+        : stage_t<I, Funcs>(std::forward<Funcs>(funcs))...
+      {}
+    }; // stages_t
     ///
-    template<typename Head>
-    class compose_t<Head> {
+    /// Accesses the function at index <code>I</code>.
+    ///
+    template<int I, typename Func>
+    inline Func& get_stage(stage_t<I, Func>& stage) {
+      return stage.func();
+    }
+    ///
+    /// Accesses the function at index <code>I</code>.
+    ///
+    template<int I, typename Func>
+    inline const Func& get_stage(const stage_t<I, Func>& stage) {
+      return stage.func();
+    }
+    // ---------------------------------------------------------------------- //
+    /// \}
+
+
+    ///
+    /// \name Chained function calls
+    ///
+    /// Threads arguments through a <code>stages_t</code> in the order
+    /// given by a sequence of indices. This is the machinery behind
+    /// both pipes and compositions; the only difference between the
+    /// two is the order of the indices. The stages type may be const
+    /// qualified, in which case the functions are called as const.
+    ///
+    /// The return type of each stage is computed exactly once, by
+    /// walking the sequence front to back, so the number of
+    /// instantiations grows linearly with the length of the chain.
+    ///
+    /// \{
+    // ---------------------------------------------------------------------- //
+    ///
+    /// Declaration.
+    ///
+    template<typename Stages, typename Seq, typename... Args> struct chain_result;
+    ///
+    /// Base case: the only remaining argument is the result.
+    ///
+    template<typename Stages, typename Result>
+    struct chain_result<Stages, seq<>, Result> {
+      typedef Result type;
+    };
+    ///
+    /// Continues a chain with the result of one stage, if the stage
+    /// could be called; otherwise there is no result type, so that a
+    /// chain that cannot be called is not a hard error (a non-const
+    /// pipe also considers its const call operator).
+    ///
+    template<typename Stages, typename Seq, typename Result, typename = void>
+    struct chain_next {};
+    template<typename Stages, typename Seq, typename Result>
+    struct chain_next<Stages, Seq, Result, typename std::conditional<true, void, typename Result::type>::type>
+      : public chain_result<Stages, Seq, typename Result::type>
+    {};
+    ///
+    /// Inductive case: apply the first function in the sequence.
+    ///
+    template<typename Stages, int I, int... Is, typename... Args>
+    struct chain_result<Stages, seq<I, Is...>, Args...>
+      : public chain_next<Stages, seq<Is...>, std::result_of<decltype(get_stage<I>(std::declval<Stages&>()))(Args&&...)> >
+    {};
+    ///
+    /// Declaration.
+    ///
+    template<typename Stages, typename Seq> struct chain_call;
+    ///
+    /// Base case.
+    ///
+    template<typename Stages, int I>
+    struct chain_call<Stages, seq<I> > {
+      template<typename... Args>
+      static inline typename chain_result<Stages, seq<I>, Args...>::type
+      call(Stages& stages, Args&&... args) {
+        return get_stage<I>(stages)(std::forward<Args>(args)...);
+      }
+    };
+    ///
+    /// Inductive case.
+    ///
+    template<typename Stages, int I, int J, int... Is>
+    struct chain_call<Stages, seq<I, J, Is...> > {
+      template<typename... Args>
+      static inline typename chain_result<Stages, seq<I, J, Is...>, Args...>::type
+      call(Stages& stages, Args&&... args) {
+        return chain_call<Stages, seq<J, Is...> >::call(stages, get_stage<I>(stages)(std::forward<Args>(args)...));
+      }
+    };
+    // ---------------------------------------------------------------------- //
+    /// \}
+
+
+    ///
+    /// Piped function object, calls the functions first to last.
+    ///
+    /// Calling a non-const pipe calls its functions as non-const,
+    /// which lets stateful stages (such as windows over a stream)
+    /// update themselves.
+    ///
+    template<typename... Funcs>
+    class pipe_t {
+      typedef stages_t<typename gen_seq<sizeof...(Funcs)>::type, Funcs...> stages_type;
+      typedef typename gen_seq<sizeof...(Funcs)>::type order_type;
     public:
-      inline compose_t(Head&& head) : head_m(std::forward<Head>(head)) {}
+      inline pipe_t(Funcs&&... funcs) : stages_m(std::forward<Funcs>(funcs)...) {}
       template<typename... Args>
-      inline typename std::result_of<Head(Args&&...)>::type
+      inline typename chain_result<const stages_type, order_type, Args...>::type
       operator()(Args&&... args) const {
-        return head_m(std::forward<Args>(args)...);
+        return chain_call<const stages_type, order_type>::call(stages_m, std::forward<Args>(args)...);
+      }
+      template<typename... Args>
+      inline typename chain_result<stages_type, order_type, Args...>::type
+      operator()(Args&&... args) {
+        return chain_call<stages_type, order_type>::call(stages_m, std::forward<Args>(args)...);
       }
     private:
-      Head head_m;
-    }; // compose_t<Head>
+      stages_type stages_m;
+    }; // pipe_t
+
+
     ///
-    /// Inductive case
+    /// Composed function object, calls the functions last to first.
     ///
-    template<typename Head, typename... Tails>
-    class compose_t<Head, Tails...> : public compose_t<Tails...> {
+    /// As with pipes, calling a non-const composition calls its
+    /// functions as non-const.
+    ///
+    template<typename... Funcs>
+    class compose_t {
+      typedef stages_t<typename gen_seq<sizeof...(Funcs)>::type, Funcs...> stages_type;
+      typedef typename gen_rseq<sizeof...(Funcs)>::type order_type;
     public:
-      inline compose_t(Head&& head, Tails&&... tails)
-        : compose_t<Tails...>(std::forward<Tails>(tails)...)
-        , head_m(std::forward<Head>(head))
-      {}
+      inline compose_t(Funcs&&... funcs) : stages_m(std::forward<Funcs>(funcs)...) {}
       template<typename... Args>
-      inline typename std::result_of<Head(typename std::result_of<compose_t<Tails...>(Args&&...)>::type)>::type
+      inline typename chain_result<const stages_type, order_type, Args...>::type
       operator()(Args&&... args) const {
-        return head_m(compose_t<Tails...>::operator()(std::forward<Args>(args)...));
+        return chain_call<const stages_type, order_type>::call(stages_m, std::forward<Args>(args)...);
+      }
+      template<typename... Args>
+      inline typename chain_result<stages_type, order_type, Args...>::type
+      operator()(Args&&... args) {
+        return chain_call<stages_type, order_type>::call(stages_m, std::forward<Args>(args)...);
       }
     private:
-      Head head_m;
-    }; // compose_t<Head, Tails...>
-    // ---------------------------------------------------------------------- //
-    /// \}
+      stages_type stages_m;
+    }; // compose_t
     
     
     ///
@@ -307,10 +621,27 @@ namespace funtup {
     }; // apply_unpack_t
     // ---------------------------------------------------------------------- //
     /// \}
-    
-    
+
+
+    ///
+    /// A function known at compile time wrapped as an empty functor.
+    ///
+    /// Since the function is part of the type rather than stored as a
+    /// pointer, the object has no state, and every call is a direct
+    /// call that the compiler is free to inline.
+    ///
+    template<typename Func, Func F>
+    struct fn_t {
+      template<typename... Args>
+      inline constexpr auto operator()(Args&&... args) const ->
+      decltype(F(std::forward<Args>(args)...)) {
+        return F(std::forward<Args>(args)...);
+      }
+    }; // fn_t
+
+
   } // namespace funtup_helper
-  
+
   
   ///
   /// Appplies the other parameters to the first parameter and returns
@@ -389,8 +720,209 @@ namespace funtup {
   auto_unpack(Func&& func) {
     return funtup_helper::apply_unpack_t<Func>(std::forward<Func>(func));
   }
-  
+
+  ///
+  /// Lifts a function pointer known at compile time into an empty
+  /// functor.
+  ///
+  /// Passing <code>&divint</code> to <code>pipe</code> stores a
+  /// function pointer, and calls through it are indirect unless the
+  /// optimizer can prove the pointer constant. The functor returned
+  /// here encodes the function in its type instead. The
+  /// <code>COM_MASAERS_FUNTUP_FN</code> macro saves spelling out the
+  /// type of the function.
+  ///
+  /*!\code
+    auto c4 = pipe(fn<decltype(&divint), &divint>(), auto_unpack(add()));
+    auto c5 = pipe(COM_MASAERS_FUNTUP_FN(&divint), auto_unpack(add()));
+    assert(c4(5, 2) == 3 && c5(5, 2) == 3);
+    \endcode*/
+  template<typename Func, Func F>
+  inline constexpr funtup_helper::fn_t<Func, F> fn() {
+    return funtup_helper::fn_t<Func, F>();
+  }
+
+  ///
+  /// The number of threads that parallel functors may spread their
+  /// work over. Defaults to the hardware concurrency; assign to the
+  /// returned reference to change it (before any parallel functor is
+  /// called).
+  ///
+  inline std::size_t& max_threads() {
+    static std::size_t n = std::max(1u, std::thread::hardware_concurrency());
+    return n;
+  }
+
   namespace funtup_helper {
+    ///
+    /// The size of the chunks <code>parallel_chunks</code> splits
+    /// <code>n</code> items into: a multiple of <code>grain</code>
+    /// that spreads the items over at most <code>max_threads()</code>
+    /// chunks.
+    ///
+    inline std::size_t chunk_size(std::size_t n, std::size_t grain) {
+      const std::size_t threads = std::max<std::size_t>(1, std::min(max_threads(), (n + grain - 1) / grain));
+      return std::max<std::size_t>(1, ((n + threads - 1) / threads + grain - 1) / grain) * grain;
+    }
+    ///
+    /// The number of chunks <code>parallel_chunks</code> splits
+    /// <code>n</code> items into; there is always at least one.
+    ///
+    inline std::size_t chunk_count(std::size_t n, std::size_t grain) {
+      return std::max<std::size_t>(1, (n + chunk_size(n, grain) - 1) / chunk_size(n, grain));
+    }
+    ///
+    /// Threads that are started once, and then kept waiting for
+    /// chunks of work for the rest of the program, so that running
+    /// something in parallel costs a wake-up rather than a thread
+    /// start per chunk.
+    ///
+    /// A job is a number of chunks that are handed out one at a time
+    /// to whichever thread asks first, including the thread that
+    /// submitted it. That thread keeps taking chunks until there are
+    /// none left, so a job always finishes, even when every pool
+    /// thread is busy elsewhere (or with a job that submitted this
+    /// one).
+    ///
+    class chunk_pool_t {
+    public:
+      inline chunk_pool_t() : stop_m(false) {}
+      inline ~chunk_pool_t() {
+        {
+          std::lock_guard<std::mutex> lock(mutex_m);
+          stop_m = true;
+        }
+        work_m.notify_all();
+        for (std::thread& thread : threads_m) {
+          thread.join();
+        }
+      }
+      ///
+      /// Calls <code>func(c)</code> for every chunk <code>c</code> in
+      /// <code>[0, chunks)</code>, on up to <code>chunks</code>
+      /// threads, and returns when all calls have returned. The
+      /// function must not throw. Once the pool has as many threads as
+      /// a job needs, running it allocates nothing.
+      ///
+      template<typename Func>
+      inline void run(std::size_t chunks, const Func& func) {
+        job_t job = { &call<Func>, &func, chunks, 0, 0 };
+        {
+          std::lock_guard<std::mutex> lock(mutex_m);
+          while (threads_m.size() + 1 < chunks) {
+            threads_m.emplace_back([this]() { work(); });
+          }
+          jobs_m.push_back(&job);
+        }
+        work_m.notify_all();
+        std::unique_lock<std::mutex> lock(mutex_m);
+        while (job.next < job.chunks) {
+          const std::size_t c = take(job);
+          lock.unlock();
+          func(c);
+          lock.lock();
+          ++job.done;
+        }
+        done_m.wait(lock, [&job]() { return job.done == job.chunks; });
+      }
+    private:
+      // A job refers to its function through a plain function pointer
+      // and the address of the function object, so that it can live on
+      // the stack of the thread that runs it.
+      struct job_t {
+        void (*call)(const void*, std::size_t);
+        const void* func;
+        std::size_t chunks;
+        std::size_t next;
+        std::size_t done;
+      };
+      std::mutex mutex_m;
+      std::condition_variable work_m;
+      std::condition_variable done_m;
+      std::vector<job_t*> jobs_m;
+      std::vector<std::thread> threads_m;
+      bool stop_m;
+      template<typename Func>
+      static inline void call(const void* func, std::size_t c) {
+        (*static_cast<const Func*>(func))(c);
+      }
+      // Hands out the next chunk of a job, and retires the job from
+      // the queue once every chunk has been handed out.
+      inline std::size_t take(job_t& job) {
+        const std::size_t c = job.next++;
+        if (job.next == job.chunks) {
+          jobs_m.erase(std::find(jobs_m.begin(), jobs_m.end(), &job));
+        }
+        return c;
+      }
+      inline void work() {
+        std::unique_lock<std::mutex> lock(mutex_m);
+        while (true) {
+          work_m.wait(lock, [this]() { return stop_m || ! jobs_m.empty(); });
+          if (stop_m) {
+            return;
+          }
+          job_t& job = *jobs_m.front();
+          const std::size_t c = take(job);
+          lock.unlock();
+          job.call(job.func, c);
+          lock.lock();
+          if (++job.done == job.chunks) {
+            done_m.notify_all();
+          }
+        }
+      }
+    }; // chunk_pool_t
+    ///
+    /// The pool that <code>parallel_chunks</code> runs on.
+    ///
+    inline chunk_pool_t& chunk_pool() {
+      static chunk_pool_t pool;
+      return pool;
+    }
+    ///
+    /// Calls <code>func(chunk, begin, end)</code> for consecutive
+    /// chunks of the range <code>[0, n)</code>, in parallel.
+    ///
+    /// Chunk boundaries fall on multiples of <code>grain</code>, so
+    /// threads writing results next to each other do not share cache
+    /// lines as long as the grain is large enough. If there is only
+    /// one chunk, it runs on the calling thread and no other thread
+    /// is involved. Otherwise the chunks are shared between the
+    /// calling thread and the threads of <code>chunk_pool()</code>,
+    /// which are started on first use and then kept. Handing chunks to
+    /// waiting threads still costs some microseconds per call, so the
+    /// grain should stand for well more work than that. If any chunk
+    /// throws, the exception from the first such chunk (in range
+    /// order) is rethrown once all chunks have finished. Nothing is
+    /// allocated unless a chunk throws or the pool needs more threads.
+    ///
+    template<typename Func>
+    inline void parallel_chunks(std::size_t n, std::size_t grain, const Func& func) {
+      const std::size_t chunks = chunk_count(n, grain);
+      if (chunks == 1) {
+        func(std::size_t(0), std::size_t(0), n);
+        return;
+      }
+      const std::size_t size = chunk_size(n, grain);
+      std::mutex error_mutex;
+      std::size_t error_chunk = chunks;
+      std::exception_ptr error;
+      chunk_pool().run(chunks, [&](std::size_t c) {
+          try {
+            func(c, c * size, std::min(n, (c + 1) * size));
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (c < error_chunk) {
+              error_chunk = c;
+              error = std::current_exception();
+            }
+          }
+        });
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
     ///
     /// A wrapper to group several functors into a single object so
     /// that they can all be called with the same parameters.
@@ -406,7 +938,282 @@ namespace funtup {
       decltype(apply_tuple(std::declval<battery_t>(), std::forward<Args>(args)...)) {
 	return apply_tuple(*this, std::forward<Args>(args)...);
       }
+      ///
+      /// Calls only the members whose bit is set in
+      /// <code>mask</code>, leaving the results of the other members
+      /// empty. Since several members may see the same arguments,
+      /// they are passed as lvalues rather than forwarded.
+      ///
+      template<typename... Args>
+      inline std::tuple<maybe_t<decltype(_apply_novoid(std::declval<const Funcs&>(), std::declval<Args&>()...))>...>
+      call_masked(const std::bitset<sizeof...(Funcs)>& mask, Args&&... args) const {
+        std::tuple<maybe_t<decltype(_apply_novoid(std::declval<const Funcs&>(), std::declval<Args&>()...))>...> result;
+        _apply_tuple_masked(*this, result, mask, make_seq<Funcs...>(), args...);
+        return result;
+      }
+      ///
+      /// Calls all the members and stores the results in an existing
+      /// tuple rather than constructing a new one, so that results
+      /// holding buffers (vectors, strings) can keep their capacity
+      /// from one call to the next. Members that provide
+      /// <code>call_into(result, args...)</code> write into their slot
+      /// directly; the results of other members are assigned.
+      ///
+      template<typename Results, typename... Args>
+      inline void call_into(Results& results, Args&&... args) const {
+        _apply_tuple_into(*this, results, make_seq<Funcs...>(), args...);
+      }
+      ///
+      /// Calls all the members, and returns the results without the
+      /// <code>void_t</code> entries of members that return
+      /// <code>void</code>. Use <code>get_member</code> to access a
+      /// result by the position of its member in the battery.
+      ///
+      template<typename... Args>
+      inline compact_tuple_t<typename kept_seq<seq<>, 0, decltype(_apply_novoid(std::declval<const Funcs&>(), std::declval<Args&>()...))...>::type,
+                             std::tuple<decltype(_apply_novoid(std::declval<const Funcs&>(), std::declval<Args&>()...))...> >
+      call_compact(Args&&... args) const {
+        return call_compact_seq(make_seq<Funcs...>(), args...);
+      }
+    private:
+      template<int... I, typename... Args>
+      inline compact_tuple_t<typename kept_seq<seq<>, 0, decltype(_apply_novoid(std::declval<const Funcs&>(), std::declval<Args&>()...))...>::type,
+                             std::tuple<decltype(_apply_novoid(std::declval<const Funcs&>(), std::declval<Args&>()...))...> >
+      call_compact_seq(seq<I...>, Args&... args) const {
+        return std::tuple<decltype(_apply_novoid(std::declval<const Funcs&>(), std::declval<Args&>()...))...>{
+          _apply_novoid(std::get<I>(*this), args...)...
+        };
+      }
     };
+    ///
+    /// A battery where all the functors are of the same type, which
+    /// are kept in a contiguous array and called in a loop.
+    ///
+    /// Functors that differ only in their state (thresholds,
+    /// weights, and the like) compile to one loop body rather than
+    /// one call per member, and a loop over plain data members is
+    /// something the compiler can vectorize. Since each member sees
+    /// the same arguments, they are passed as lvalues rather than
+    /// forwarded. The result type must be default constructible.
+    ///
+    template<typename Func, std::size_t N>
+    struct array_battery_t : public std::array<Func, N> {
+      inline array_battery_t(std::array<Func, N>&& funcs)
+        : std::array<Func, N>(std::move(funcs))
+      {}
+      template<typename... Args>
+      inline std::array<decltype(_apply_novoid(std::declval<const Func&>(), std::declval<Args&>()...)), N>
+      operator()(Args&&... args) const {
+        std::array<decltype(_apply_novoid(std::declval<const Func&>(), std::declval<Args&>()...)), N> result;
+        for (std::size_t i = 0; i < N; ++i) {
+          result[i] = _apply_novoid((*this)[i], args...);
+        }
+        return result;
+      }
+    }; // array_battery_t
+    ///
+    /// The element type of a result vector that threads may fill side
+    /// by side: anything but <code>bool</code>, which is kept as
+    /// <code>char</code>.
+    ///
+    template<typename Result>
+    struct element_for { typedef Result type; };
+    template<>
+    struct element_for<bool> { typedef char type; };
+    ///
+    /// A battery of functors of the same type whose size is only
+    /// known at runtime.
+    ///
+    /// The members are kept in a vector and evaluated in a loop that
+    /// the compiler can vectorize across member state. Above
+    /// <code>grain</code> members, the loop is split into chunks
+    /// that run in parallel (see <code>max_threads</code> and
+    /// <code>parallel_chunks</code>), which only pays off once a chunk
+    /// takes well over the few microseconds it costs to hand it to
+    /// another thread. Results are written into a buffer that the
+    /// caller can hold on to between calls, so a steady-state loop
+    /// does not allocate.
+    ///
+    /// Boolean results are returned as a vector of <code>char</code>,
+    /// since threads may not write to neighbouring elements of a bit
+    /// packed <code>std::vector&lt;bool&gt;</code>. Calling
+    /// <code>call_into</code> with one anyway works, but serially.
+    ///
+    template<typename Func>
+    struct dynamic_battery_t : public std::vector<Func> {
+      inline dynamic_battery_t(std::vector<Func>&& funcs, std::size_t grain)
+        : std::vector<Func>(std::move(funcs))
+        // Chunks of whole cache lines, for results of a byte or more.
+        , grain_m((std::max<std::size_t>(grain, 1) + 63) / 64 * 64)
+      {}
+      ///
+      /// Evaluates all members and stores the results in
+      /// <code>result</code>, which is resized to the number of
+      /// members.
+      ///
+      template<typename Result, typename... Args>
+      inline void call_into(std::vector<Result>& result, Args&&... args) const {
+        const Func* funcs = this->data();
+        result.resize(this->size());
+        const auto run = [&](std::size_t, std::size_t begin, std::size_t end) {
+          for (std::size_t i = begin; i < end; ++i) {
+            result[i] = _apply_novoid(funcs[i], args...);
+          }
+        };
+        if (std::is_same<Result, bool>::value) {
+          run(0, 0, this->size());
+        } else {
+          parallel_chunks(this->size(), grain_m, run);
+        }
+      }
+      ///
+      /// Evaluates all members and returns a fresh vector of results.
+      ///
+      template<typename... Args>
+      inline std::vector<typename element_for<decltype(_apply_novoid(std::declval<const Func&>(), std::declval<Args&>()...))>::type>
+      operator()(Args&&... args) const {
+        std::vector<typename element_for<decltype(_apply_novoid(std::declval<const Func&>(), std::declval<Args&>()...))>::type> result;
+        call_into(result, args...);
+        return result;
+      }
+    private:
+      std::size_t grain_m;
+    }; // dynamic_battery_t
+    ///
+    /// A functor tagged with whether it is required to run in an
+    /// <code>anytime_battery_t</code>, and if not, how important it
+    /// is (higher priorities run first) and how long it is expected to
+    /// take before it has been measured.
+    ///
+    template<typename Func>
+    class member_t {
+    public:
+      inline member_t(Func&& func, bool required, int priority, std::chrono::steady_clock::duration initial_cost)
+        : func_m(std::forward<Func>(func))
+        , required_m(required)
+        , priority_m(priority)
+        , initial_cost_m(initial_cost)
+      {}
+      template<typename... Args>
+      inline auto operator()(Args&&... args) const ->
+      decltype(std::declval<const Func&>()(std::forward<Args>(args)...)) {
+        return func_m(std::forward<Args>(args)...);
+      }
+      inline bool required() const { return required_m; }
+      inline int priority() const { return priority_m; }
+      inline std::chrono::steady_clock::duration initial_cost() const { return initial_cost_m; }
+    private:
+      Func func_m;
+      bool required_m;
+      int priority_m;
+      std::chrono::steady_clock::duration initial_cost_m;
+    }; // member_t
+    ///
+    /// A battery that is called with a deadline, and only calls as
+    /// many of its deferrable members as it expects to have time for.
+    ///
+    /// Required members are always called, in order. Then the
+    /// deferrable members are considered in order of priority, and
+    /// each one is called if its expected cost still fits before the
+    /// deadline. The expected cost of a member is a moving average of
+    /// how long it took the previous times it was called, which is
+    /// updated on every call and starts from the first measurement.
+    /// Until a member has been measured, its initial cost estimate is
+    /// used instead. Every time a member is skipped, its estimate
+    /// shrinks by the same weight as a measurement of no time at all,
+    /// so a member that was slow once is tried again after a number
+    /// of skips that grows with how far it overshot the budget, and a
+    /// member that has become cheap is not left out for good. Keeping
+    /// these statistics means the battery should not be called from
+    /// several threads at once.
+    ///
+    /// The result is a tuple of <code>maybe_t</code> where the members
+    /// that were skipped are empty.
+    ///
+    template<typename... Funcs>
+    class anytime_battery_t : public std::tuple<Funcs...> {
+    public:
+      typedef std::chrono::steady_clock clock_type;
+      inline anytime_battery_t(Funcs&&... funcs)
+        : std::tuple<Funcs...>(std::forward<Funcs>(funcs)...)
+        , cost_m()
+        , measured_m()
+      {
+        init(make_seq<Funcs...>());
+      }
+      template<typename... Args>
+      inline std::tuple<maybe_t<decltype(_apply_novoid(std::declval<const Funcs&>(), std::declval<Args&>()...))>...>
+      operator()(clock_type::time_point deadline, Args&&... args) const {
+        std::tuple<maybe_t<decltype(_apply_novoid(std::declval<const Funcs&>(), std::declval<Args&>()...))>...> result;
+        run(make_seq<Funcs...>(), result, deadline, args...);
+        return result;
+      }
+      ///
+      /// The current estimate of how long member <code>i</code> takes
+      /// to call.
+      ///
+      inline clock_type::duration expected_cost(std::size_t i) const {
+        return clock_type::duration(static_cast<clock_type::rep>(cost_m[i]));
+      }
+    private:
+      static const std::size_t size = sizeof...(Funcs);
+      /// The weight of the latest observation in the moving average.
+      static constexpr double alpha = 0.125;
+      std::array<bool, size> required_m;
+      std::array<std::size_t, size> order_m;
+      mutable std::array<double, size> cost_m;
+      mutable std::array<bool, size> measured_m;
+      template<int... I>
+      inline void init(seq<I...>) {
+        required_m = {{ std::get<I>(*this).required()... }};
+        cost_m = {{ static_cast<double>(std::get<I>(*this).initial_cost().count())... }};
+        const std::array<int, size> priority = {{ std::get<I>(*this).priority()... }};
+        for (std::size_t i = 0; i < size; ++i) {
+          order_m[i] = i;
+        }
+        std::stable_sort(order_m.begin(), order_m.end(), [&priority](std::size_t a, std::size_t b) {
+            return priority[a] > priority[b];
+          });
+      }
+      template<int I, typename Results, typename... Args>
+      static inline void call_member(const anytime_battery_t& self, Results& results, Args&... args) {
+        std::get<I>(results).emplace(_apply_novoid(std::get<I>(self), args...));
+      }
+      template<int... I, typename Results, typename... Args>
+      inline void run(seq<I...>, Results& results, clock_type::time_point deadline, Args&... args) const {
+        typedef void (*call_type)(const anytime_battery_t&, Results&, Args&...);
+        static const call_type calls[] = { &call_member<I, Results, Args...>... };
+        clock_type::time_point now = clock_type::now();
+        for (std::size_t i = 0; i < size; ++i) {
+          if (required_m[i]) {
+            now = timed_call(calls[i], i, now, results, args...);
+          }
+        }
+        for (std::size_t i : order_m) {
+          if (required_m[i]) {
+            continue;
+          }
+          if (now + expected_cost(i) <= deadline) {
+            now = timed_call(calls[i], i, now, results, args...);
+          } else {
+            cost_m[i] -= alpha * cost_m[i];
+          }
+        }
+      }
+      template<typename Call, typename Results, typename... Args>
+      inline clock_type::time_point timed_call(Call call, std::size_t i, clock_type::time_point start, Results& results, Args&... args) const {
+        call(*this, results, args...);
+        const clock_type::time_point end = clock_type::now();
+        const double cost = static_cast<double>((end - start).count());
+        if (measured_m[i]) {
+          cost_m[i] += alpha * (cost - cost_m[i]);
+        } else {
+          cost_m[i] = cost;
+          measured_m[i] = true;
+        }
+        return end;
+      }
+    }; // anytime_battery_t
   } // namespace funtup_helper
   
   ///
@@ -421,12 +1228,132 @@ namespace funtup {
     std::tuple<int, int> r = b(3, 4);
     std::cout << std::get<0>(r) << std::endl; // prints 7
     std::cout << std::get<1>(r) << std::endl; // prints 12
+    auto m = b.call_masked(0x2, 3, 4);
+    std::cout << bool(std::get<0>(m)) << std::endl; // prints 0
+    std::cout << *std::get<1>(m) << std::endl; // prints 12
   \endcode*/
   template<typename... Funcs>
   inline constexpr funtup_helper::battery_t<Funcs...>
   battery(Funcs&&... funcs) {
     return funtup_helper::battery_t<Funcs...>(std::forward<Funcs>(funcs)...);
   }
+
+  ///
+  /// Accesses the result of member <code>I</code> of a battery in the
+  /// compact results returned from <code>call_compact</code>.
+  ///
+  /*!\code
+    auto b = battery(add(), log_args(), mul()); // log_args returns void
+    auto r = b.call_compact(3, 4);              // std::tuple<int, int>
+    assert(get_member<2>(r) == std::get<1>(r));
+  \endcode*/
+  template<int I, typename Kept, typename Results>
+  inline auto get_member(funtup_helper::compact_tuple_t<Kept, Results>& results) ->
+  decltype(std::get<funtup_helper::compact_tuple_t<Kept, Results>::template position<I>::value>(results)) {
+    return std::get<funtup_helper::compact_tuple_t<Kept, Results>::template position<I>::value>(results);
+  }
+
+  ///
+  /// Accesses the result of member <code>I</code> of a battery in the
+  /// compact results returned from <code>call_compact</code>.
+  ///
+  template<int I, typename Kept, typename Results>
+  inline auto get_member(const funtup_helper::compact_tuple_t<Kept, Results>& results) ->
+  decltype(std::get<funtup_helper::compact_tuple_t<Kept, Results>::template position<I>::value>(results)) {
+    return std::get<funtup_helper::compact_tuple_t<Kept, Results>::template position<I>::value>(results);
+  }
+
+  ///
+  /// Builds a battery from several functors of the same type, which
+  /// returns a <code>std::array</code> rather than a tuple.
+  ///
+  /// The functors are copied (or moved) into the battery, since they
+  /// are stored in an array.
+  ///
+  /*!\code
+    struct above { int t; bool operator()(int x) const { return x > t; } };
+    auto b = array_battery(above{1}, above{5}, above{10});
+    std::array<bool, 3> r = b(6); // { true, true, false }
+  \endcode*/
+  template<typename Func, typename... Funcs>
+  inline funtup_helper::array_battery_t<typename std::decay<Func>::type, 1 + sizeof...(Funcs)>
+  array_battery(Func&& func, Funcs&&... funcs) {
+    typedef typename std::decay<Func>::type func_type;
+    static_assert(std::is_same<std::tuple<func_type, typename std::decay<Funcs>::type...>,
+                               std::tuple<typename std::decay<Funcs>::type..., func_type> >::value,
+                  "all functors in an array battery must be of the same type");
+    return funtup_helper::array_battery_t<func_type, 1 + sizeof...(Funcs)>
+      (std::array<func_type, 1 + sizeof...(Funcs)>{{ std::forward<Func>(func), std::forward<Funcs>(funcs)... }});
+  }
+
+  ///
+  /// Builds a battery from an array of functors.
+  ///
+  template<typename Func, std::size_t N>
+  inline funtup_helper::array_battery_t<Func, N>
+  array_battery(std::array<Func, N> funcs) {
+    return funtup_helper::array_battery_t<Func, N>(std::move(funcs));
+  }
+
+  ///
+  /// Builds a battery from a vector of functors of the same type,
+  /// which is evaluated in parallel chunks of (at least)
+  /// <code>grain</code> members when it is large enough. The default
+  /// grain is meant for members that take a few nanoseconds each, so
+  /// that a chunk takes some 100 microseconds, far more than handing
+  /// it to another thread; <code>battery_bench.cpp</code> measures
+  /// where the parallel path starts to win on a given machine.
+  ///
+  /*!\code
+    std::vector<above> rules = load_rules();
+    auto b = dynamic_battery(std::move(rules));
+    std::vector<char> fired;
+    b.call_into(fired, 6); // fired[i] == rules[i](6)
+  \endcode*/
+  template<typename Func>
+  inline funtup_helper::dynamic_battery_t<Func>
+  dynamic_battery(std::vector<Func> funcs, std::size_t grain = 65536) {
+    return funtup_helper::dynamic_battery_t<Func>(std::move(funcs), grain);
+  }
+
+  ///
+  /// Tags a functor as required in an <code>anytime_battery</code>.
+  ///
+  template<typename Func>
+  inline funtup_helper::member_t<Func> required(Func&& func) {
+    return funtup_helper::member_t<Func>(std::forward<Func>(func), true, 0, std::chrono::steady_clock::duration::zero());
+  }
+
+  ///
+  /// Tags a functor as deferrable in an <code>anytime_battery</code>,
+  /// with a priority (higher runs first), and how long it is expected
+  /// to take until it has been measured. By default that is no time
+  /// at all, so every member runs (and is measured) on the first call
+  /// that has any time left; pass an estimate to keep a member that is
+  /// known to be slow out of tight budgets from the start.
+  ///
+  template<typename Func>
+  inline funtup_helper::member_t<Func> deferrable(int priority, Func&& func,
+                                                  std::chrono::steady_clock::duration initial_cost = std::chrono::steady_clock::duration::zero()) {
+    return funtup_helper::member_t<Func>(std::forward<Func>(func), false, priority, initial_cost);
+  }
+
+  ///
+  /// Builds a battery that is called with a deadline in addition to
+  /// the arguments, and skips deferrable members it does not expect
+  /// to have time for. Every member must be tagged with either
+  /// <code>required</code> or <code>deferrable</code>.
+  ///
+  /*!\code
+    auto b = anytime_battery(required(parse()), deferrable(2, enrich()), deferrable(1, score()));
+    auto r = b(std::chrono::steady_clock::now() + std::chrono::microseconds(200), request);
+    if (std::get<2>(r)) { use_score(*std::get<2>(r)); }
+  \endcode*/
+  template<typename... Funcs>
+  inline funtup_helper::anytime_battery_t<Funcs...>
+  anytime_battery(Funcs&&... funcs) {
+    return funtup_helper::anytime_battery_t<Funcs...>(std::forward<Funcs>(funcs)...);
+  }
   
   ///
   /// A function that makes a copy of whatever is passed in.
@@ -443,5 +1370,12 @@ namespace funtup {
 } // namespace funtup
 } // namespace com_masaers
 
+///
+/// Lifts the function <code>f</code> into an empty functor that calls
+/// it directly (see <code>com_masaers::funtup::fn</code>).
+///
+#define COM_MASAERS_FUNTUP_FN(f) \
+  ::com_masaers::funtup::fn<decltype(f), f>()
+
 #endif
 
@@ -0,0 +1,1130 @@
+#ifndef COM_MASAERS_FUNTUP_ASYNC_HPP
+#define COM_MASAERS_FUNTUP_ASYNC_HPP
+///
+/// \file
+///
+/// \brief Functors that hand their work to other threads, to be used
+/// as stages in pipes over streams.
+///
+#include "funtup.hpp"
+#include "funtup_range.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <stdexcept>
+#include <cmath>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+namespace com_masaers {
+namespace funtup {
+  namespace funtup_helper {
+    ///
+    /// Waits a little longer every time it is asked to: first by
+    /// yielding, then by sleeping, so that a thread polling an empty
+    /// queue reacts quickly under load without burning a core when
+    /// idle.
+    ///
+    class backoff_t {
+    public:
+      inline backoff_t() : tries_m(0) {}
+      inline void pause() {
+        if (++tries_m < 64) {
+          std::this_thread::yield();
+        } else {
+          std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+      }
+      inline void reset() { tries_m = 0; }
+    private:
+      std::size_t tries_m;
+    }; // backoff_t
+    ///
+    /// A bounded lock-free queue that any number of threads may push
+    /// to and pop from (Dmitry Vyukov's bounded MPMC queue).
+    ///
+    /// Every cell carries a sequence number that tells producers and
+    /// consumers whose turn it is, so claiming a cell is a single
+    /// compare and swap on the head or tail counter, and the value
+    /// itself is handed over without locks.
+    ///
+    template<typename T>
+    class bounded_queue_t {
+    public:
+      inline explicit bounded_queue_t(std::size_t capacity)
+        : mask_m(round_up(std::max<std::size_t>(capacity, 2)) - 1)
+        , cells_m(new cell_t[mask_m + 1])
+        , push_m(0)
+        , pop_m(0)
+      {
+        for (std::size_t i = 0; i <= mask_m; ++i) {
+          cells_m[i].seq.store(i, std::memory_order_relaxed);
+        }
+      }
+      ///
+      /// Moves <code>x</code> into the queue, unless it is full.
+      ///
+      inline bool try_push(T& x) {
+        std::size_t pos = push_m.load(std::memory_order_relaxed);
+        cell_t* cell;
+        for (;;) {
+          cell = &cells_m[pos & mask_m];
+          const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+          const std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos);
+          if (diff == 0) {
+            if (push_m.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+              break;
+            }
+          } else if (diff < 0) {
+            return false;
+          } else {
+            pos = push_m.load(std::memory_order_relaxed);
+          }
+        }
+        cell->value = std::move(x);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+      ///
+      /// Moves <code>x</code> into the queue, waiting for room if it
+      /// is full.
+      ///
+      inline void push(T x) {
+        backoff_t backoff;
+        while (! try_push(x)) {
+          backoff.pause();
+        }
+      }
+      ///
+      /// Moves the oldest value in the queue to <code>x</code>, unless
+      /// the queue is empty.
+      ///
+      inline bool try_pop(T& x) {
+        std::size_t pos = pop_m.load(std::memory_order_relaxed);
+        cell_t* cell;
+        for (;;) {
+          cell = &cells_m[pos & mask_m];
+          const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+          const std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos + 1);
+          if (diff == 0) {
+            if (pop_m.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+              break;
+            }
+          } else if (diff < 0) {
+            return false;
+          } else {
+            pos = pop_m.load(std::memory_order_relaxed);
+          }
+        }
+        x = std::move(cell->value);
+        cell->seq.store(pos + mask_m + 1, std::memory_order_release);
+        return true;
+      }
+    private:
+      struct cell_t {
+        std::atomic<std::size_t> seq;
+        T value;
+      };
+      static inline std::size_t round_up(std::size_t n) {
+        std::size_t result = 1;
+        while (result < n) {
+          result *= 2;
+        }
+        return result;
+      }
+      const std::size_t mask_m;
+      std::unique_ptr<cell_t[]> cells_m;
+      // Padding keeps producers and consumers off each other's cache
+      // line without needing over-aligned allocation.
+      char pad0_m[64];
+      std::atomic<std::size_t> push_m;
+      char pad1_m[64];
+      std::atomic<std::size_t> pop_m;
+    }; // bounded_queue_t
+    ///
+    /// Remembers the first exception thrown on a worker thread, so
+    /// that it can be rethrown on the thread that owns the workers.
+    ///
+    class first_error_t {
+    public:
+      inline void set(std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(mutex_m);
+        if (! error_m) {
+          error_m = error;
+        }
+      }
+      inline void rethrow() {
+        std::exception_ptr error;
+        {
+          std::lock_guard<std::mutex> lock(mutex_m);
+          std::swap(error, error_m);
+        }
+        if (error) {
+          std::rethrow_exception(error);
+        }
+      }
+    private:
+      std::mutex mutex_m;
+      std::exception_ptr error_m;
+    }; // first_error_t
+    ///
+    /// Runs a function over the values pushed to it, on a thread of
+    /// its own, in the order they were pushed. Any number of threads
+    /// may push. Exceptions thrown by the function are handed to
+    /// <code>error</code>.
+    ///
+    template<typename T, typename Func>
+    class worker_t {
+    public:
+      template<typename F>
+      inline worker_t(std::size_t capacity, F&& func, first_error_t& error)
+        : func_m(std::forward<F>(func))
+        , queue_m(capacity)
+        , error_m(error)
+        , pushed_m(0)
+        , done_m(0)
+        , stop_m(false)
+        , thread_m([this]() { run(); })
+      {}
+      worker_t(const worker_t&) = delete;
+      worker_t& operator=(const worker_t&) = delete;
+      inline ~worker_t() {
+        wait();
+        stop_m.store(true, std::memory_order_release);
+        thread_m.join();
+      }
+      inline void push(T x) {
+        pushed_m.fetch_add(1, std::memory_order_relaxed);
+        queue_m.push(std::move(x));
+      }
+      ///
+      /// Waits until everything pushed so far has been processed.
+      ///
+      inline void wait() const {
+        const std::size_t pushed = pushed_m.load(std::memory_order_acquire);
+        backoff_t backoff;
+        while (done_m.load(std::memory_order_acquire) < pushed) {
+          backoff.pause();
+        }
+      }
+      ///
+      /// The function itself, which may only be touched while the
+      /// worker is idle, i.e. after <code>wait()</code>.
+      ///
+      inline Func& func() { return func_m; }
+      inline const Func& func() const { return func_m; }
+    private:
+      Func func_m;
+      bounded_queue_t<T> queue_m;
+      first_error_t& error_m;
+      std::atomic<std::size_t> pushed_m;
+      std::atomic<std::size_t> done_m;
+      std::atomic<bool> stop_m;
+      std::thread thread_m;
+      inline void run() {
+        backoff_t backoff;
+        T x;
+        for (;;) {
+          if (queue_m.try_pop(x)) {
+            try {
+              func_m(x);
+            } catch (...) {
+              error_m.set(std::current_exception());
+            }
+            x = T();
+            done_m.fetch_add(1, std::memory_order_release);
+            backoff.reset();
+          } else if (stop_m.load(std::memory_order_acquire)) {
+            return;
+          } else {
+            backoff.pause();
+          }
+        }
+      }
+    }; // worker_t
+    ///
+    /// Calls a function with the value pointed to, rather than the
+    /// pointer.
+    ///
+    template<typename Func>
+    struct deref_t {
+      Func func;
+      template<typename Ptr>
+      inline void operator()(const Ptr& ptr) { func(*ptr); }
+    }; // deref_t
+    ///
+    /// Broadcasts every input to several branches, each running on a
+    /// worker thread of its own.
+    ///
+    /// An input is moved once into a reference counted, immutable
+    /// buffer, and every branch gets a pointer to that same buffer
+    /// through its own queue, so an expensive input is neither copied
+    /// per branch nor held up by the slowest branch (until its queue
+    /// fills up).
+    ///
+    template<typename T, typename... Branches>
+    class tee_t {
+    public:
+      typedef std::shared_ptr<const T> item_type;
+      inline tee_t(std::size_t capacity, Branches&&... branches)
+        : error_m(new first_error_t())
+        , workers_m(std::unique_ptr<worker_type<Branches> >(new worker_type<Branches>(capacity, deref_t<typename std::decay<Branches>::type>{ std::forward<Branches>(branches) }, *error_m))...)
+      {}
+      ///
+      /// Hands an input to every branch.
+      ///
+      inline void operator()(item_type item) {
+        push(item, make_seq<Branches...>());
+      }
+      inline void operator()(T x) {
+        (*this)(item_type(std::make_shared<const T>(std::move(x))));
+      }
+      ///
+      /// Waits until every branch has processed every input so far,
+      /// and rethrows the first exception thrown by a branch, if any.
+      ///
+      inline void flush() {
+        wait(make_seq<Branches...>());
+        error_m->rethrow();
+      }
+    private:
+      template<typename Branch>
+      using worker_type = worker_t<item_type, deref_t<typename std::decay<Branch>::type> >;
+      // Declared first so that it outlives the workers.
+      std::unique_ptr<first_error_t> error_m;
+      std::tuple<std::unique_ptr<worker_type<Branches> >...> workers_m;
+      template<int... I>
+      inline void push(const item_type& item, seq<I...>) {
+        const int expand[] = { 0, (std::get<I>(workers_m)->push(item), 0)... };
+        (void)expand;
+      }
+      template<int... I>
+      inline void wait(seq<I...>) const {
+        const int expand[] = { 0, (std::get<I>(workers_m)->wait(), 0)... };
+        (void)expand;
+      }
+    }; // tee_t
+    ///
+    /// Routes every input to one of several shards by the hash of its
+    /// key, each shard being a separate instance of a function
+    /// running on a worker thread of its own.
+    ///
+    /// All inputs with the same key go to the same shard, in the order
+    /// they were passed in (by any one thread), so a shard may keep
+    /// per-key state without synchronization. Any number of threads
+    /// may call the partition at the same time.
+    ///
+    template<typename T, typename KeyFn, typename Shard>
+    class partition_t {
+    public:
+      template<typename Factory>
+      inline partition_t(KeyFn key_fn, std::size_t n, Factory&& factory, std::size_t capacity)
+        : key_fn_m(std::move(key_fn))
+        , error_m(new first_error_t())
+      {
+        shards_m.reserve(n);
+        for (std::size_t i = 0; i < n; ++i) {
+          shards_m.emplace_back(new worker_t<T, Shard>(capacity, factory(i), *error_m));
+        }
+      }
+      ///
+      /// Hands an input to the shard that owns its key.
+      ///
+      inline void operator()(T x) const {
+        const std::uint64_t hash = mixed_hash(key_fn_m(x));
+        shards_m[(hash >> 32) * shards_m.size() >> 32]->push(std::move(x));
+      }
+      ///
+      /// Waits until every shard has processed every input so far,
+      /// and rethrows the first exception thrown by a shard, if any.
+      ///
+      inline void flush() {
+        for (const std::unique_ptr<worker_t<T, Shard> >& shard : shards_m) {
+          shard->wait();
+        }
+        error_m->rethrow();
+      }
+      inline std::size_t size() const { return shards_m.size(); }
+      ///
+      /// Shard number <code>i</code>, which may only be touched after
+      /// <code>flush()</code>, while no more inputs are passed in.
+      ///
+      inline Shard& shard(std::size_t i) { return shards_m[i]->func(); }
+      inline const Shard& shard(std::size_t i) const { return shards_m[i]->func(); }
+    private:
+      KeyFn key_fn_m;
+      // Declared before the shards so that it outlives them.
+      std::unique_ptr<first_error_t> error_m;
+      std::vector<std::unique_ptr<worker_t<T, Shard> > > shards_m;
+    }; // partition_t
+    ///
+    /// Collects single inputs into batches, and calls a function that
+    /// takes a whole batch once per batch, either when the batch is
+    /// full or when its oldest input has waited long enough. Each
+    /// input comes with a continuation, which gets the result for that
+    /// input, and optionally an error continuation, which gets the
+    /// exception instead if the batch function throws.
+    ///
+    /// A full batch is run by the thread that filled it, and a late
+    /// one by a timer thread, so continuations may run on either. Each
+    /// continuation is called on its own, so one that throws does not
+    /// keep the others from being called.
+    ///
+    template<typename T, typename BatchFn>
+    class batch_by_t {
+    public:
+      typedef typename std::decay<typename std::result_of<const BatchFn&(std::vector<T>&)>::type>::type results_type;
+      typedef typename results_type::value_type result_type;
+      typedef std::function<void(result_type)> continuation_type;
+      typedef std::function<void(std::exception_ptr)> error_continuation_type;
+      typedef std::chrono::steady_clock clock_type;
+      inline batch_by_t(std::size_t n, clock_type::duration max_delay, BatchFn batch_fn)
+        : shared_m(new shared_t(std::max<std::size_t>(n, 1), max_delay, std::move(batch_fn)))
+      {
+        shared_t* shared = shared_m.get();
+        shared->timer = std::thread([shared]() { shared->time(); });
+      }
+      batch_by_t(batch_by_t&&) = default;
+      ///
+      /// Finishes the batches of this stage, as the destructor would,
+      /// before taking over the other one.
+      ///
+      inline batch_by_t& operator=(batch_by_t&& o) {
+        if (this != &o) {
+          close();
+          shared_m = std::move(o.shared_m);
+        }
+        return *this;
+      }
+      inline ~batch_by_t() {
+        close();
+      }
+      ///
+      /// Adds an input to the current batch, and arranges for
+      /// <code>cont</code> to be called with its result. If the batch
+      /// fails, the exception is rethrown by the next
+      /// <code>flush()</code>.
+      ///
+      inline void operator()(T x, continuation_type cont) {
+        (*this)(std::move(x), std::move(cont), error_continuation_type());
+      }
+      ///
+      /// Adds an input to the current batch, and arranges for
+      /// <code>cont</code> to be called with its result, or
+      /// <code>on_error</code> with the exception if the batch fails.
+      ///
+      inline void operator()(T x, continuation_type cont, error_continuation_type on_error) {
+        batch_t batch;
+        {
+          std::lock_guard<std::mutex> lock(shared_m->mutex);
+          if (shared_m->inputs.empty()) {
+            shared_m->oldest = clock_type::now();
+            shared_m->wake.notify_all();
+          }
+          shared_m->inputs.push_back(std::move(x));
+          shared_m->conts.push_back(std::move(cont));
+          shared_m->on_errors.push_back(std::move(on_error));
+          if (shared_m->inputs.size() < shared_m->n) {
+            return;
+          }
+          shared_m->take(batch);
+        }
+        shared_m->run(batch);
+      }
+      ///
+      /// Runs the current batch regardless of its size and age, waits
+      /// for all batches to finish, and rethrows the first exception
+      /// thrown by a continuation, or by the batch function for a batch
+      /// with an input that has no error continuation, if any.
+      ///
+      inline void flush() {
+        batch_t batch;
+        {
+          std::lock_guard<std::mutex> lock(shared_m->mutex);
+          shared_m->take(batch);
+        }
+        shared_m->run(batch);
+        {
+          std::unique_lock<std::mutex> lock(shared_m->mutex);
+          while (shared_m->running != 0) {
+            shared_m->idle.wait(lock);
+          }
+        }
+        shared_m->error.rethrow();
+      }
+    private:
+      struct batch_t {
+        std::vector<T> inputs;
+        std::vector<continuation_type> conts;
+        std::vector<error_continuation_type> on_errors;
+      };
+      struct shared_t {
+        inline shared_t(std::size_t n, clock_type::duration max_delay, BatchFn&& batch_fn)
+          : n(n), max_delay(max_delay), batch_fn(std::move(batch_fn)), running(0), stop(false)
+        {}
+        const std::size_t n;
+        const clock_type::duration max_delay;
+        const BatchFn batch_fn;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        std::vector<T> inputs;
+        std::vector<continuation_type> conts;
+        std::vector<error_continuation_type> on_errors;
+        clock_type::time_point oldest;
+        std::size_t running;
+        bool stop;
+        first_error_t error;
+        std::thread timer;
+        // Called with the mutex held.
+        inline void take(batch_t& batch) {
+          if (! inputs.empty()) {
+            batch.inputs.swap(inputs);
+            batch.conts.swap(conts);
+            batch.on_errors.swap(on_errors);
+            ++running;
+          }
+        }
+        inline void run(batch_t& batch) {
+          if (batch.inputs.empty()) {
+            return;
+          }
+          results_type results;
+          std::exception_ptr failure;
+          try {
+            _apply_into(batch_fn, results, 0, batch.inputs);
+            if (results.size() != batch.inputs.size()) {
+              throw std::length_error("batch_by: the batch function returned the wrong number of results");
+            }
+          } catch (...) {
+            failure = std::current_exception();
+          }
+          for (std::size_t i = 0; i < batch.conts.size(); ++i) {
+            try {
+              if (! failure) {
+                batch.conts[i](results[i]);
+              } else if (batch.on_errors[i]) {
+                batch.on_errors[i](failure);
+              } else {
+                error.set(failure);
+              }
+            } catch (...) {
+              error.set(std::current_exception());
+            }
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          --running;
+          idle.notify_all();
+        }
+        inline void time() {
+          std::unique_lock<std::mutex> lock(mutex);
+          while (! stop) {
+            if (inputs.empty()) {
+              wake.wait(lock);
+            } else if (clock_type::now() < oldest + max_delay) {
+              wake.wait_until(lock, oldest + max_delay);
+            } else {
+              batch_t batch;
+              take(batch);
+              lock.unlock();
+              run(batch);
+              lock.lock();
+            }
+          }
+        }
+      };
+      std::unique_ptr<shared_t> shared_m;
+      inline void close() {
+        if (shared_m) {
+          try {
+            flush();
+          } catch (...) {
+          }
+          {
+            std::lock_guard<std::mutex> lock(shared_m->mutex);
+            shared_m->stop = true;
+          }
+          shared_m->wake.notify_all();
+          shared_m->timer.join();
+          shared_m.reset();
+        }
+      }
+    }; // batch_by_t
+    ///
+    /// Lets concurrent calls with equal arguments share a single call
+    /// of the wrapped function: the first caller computes the result,
+    /// and callers that arrive while it is in flight wait for it
+    /// instead of computing it again. Exceptions are shared the same
+    /// way. Once a call is done, the next call with the same arguments
+    /// computes afresh, so this is not a cache, but it keeps a herd of
+    /// callers from recomputing a hot key at the same moment (e.g.
+    /// right after it expired from a cache).
+    ///
+    template<typename Func, typename... Args>
+    class coalesce_t {
+    public:
+      typedef std::tuple<typename std::decay<Args>::type...> key_type;
+      typedef typename std::decay<decltype(_apply_novoid(std::declval<const Func&>(), std::declval<const Args&>()...))>::type result_type;
+      inline explicit coalesce_t(Func func)
+        : func_m(std::move(func))
+        , shared_m(new shared_t())
+      {}
+      inline result_type operator()(const Args&... args) const {
+        const key_type key(args...);
+        std::promise<result_type> promise;
+        std::shared_future<result_type> future;
+        bool first = false;
+        {
+          std::lock_guard<std::mutex> lock(shared_m->mutex);
+          typename std::map<key_type, std::shared_future<result_type> >::iterator it = shared_m->in_flight.find(key);
+          if (it == shared_m->in_flight.end()) {
+            future = promise.get_future().share();
+            shared_m->in_flight.insert(it, std::make_pair(key, future));
+            first = true;
+          } else {
+            future = it->second;
+          }
+        }
+        if (first) {
+          try {
+            promise.set_value(_apply_novoid(func_m, args...));
+          } catch (...) {
+            promise.set_exception(std::current_exception());
+          }
+          std::lock_guard<std::mutex> lock(shared_m->mutex);
+          shared_m->in_flight.erase(key);
+        }
+        return future.get();
+      }
+      ///
+      /// The number of distinct calls in flight.
+      ///
+      inline std::size_t in_flight() const {
+        std::lock_guard<std::mutex> lock(shared_m->mutex);
+        return shared_m->in_flight.size();
+      }
+    private:
+      struct shared_t {
+        std::mutex mutex;
+        std::map<key_type, std::shared_future<result_type> > in_flight;
+      };
+      Func func_m;
+      std::unique_ptr<shared_t> shared_m;
+    }; // coalesce_t
+    ///
+    /// A blocked Bloom filter that any number of threads may add to
+    /// and query at the same time.
+    ///
+    /// All the bits of a key lie in one 512 bit block, i.e. one cache
+    /// line, chosen by its whole hash mixed once more, and the lower
+    /// half of the hash picks the bits within the block, so a query
+    /// costs a single cache miss. The extra mix keeps the blocks evenly
+    /// used when the keys have been picked by their hash, as the keys
+    /// of one <code>partition</code> shard are. Bits are set with an atomic or, and since they are never
+    /// cleared, a key that has been added is always found.
+    ///
+    class bloom_filter_t {
+    public:
+      ///
+      /// Sizes the filter for <code>expected</code> keys at a false
+      /// positive rate of about <code>fp_rate</code>.
+      ///
+      inline bloom_filter_t(std::size_t expected, double fp_rate)
+        : blocks_m(0)
+        , hashes_m(0)
+      {
+        const double n = double(std::max<std::size_t>(expected, 1));
+        const double p = std::min(std::max(fp_rate, 1e-9), 0.5);
+        const double ln2 = std::log(2.0);
+        // Blocking costs some accuracy, which 20% more bits make up for.
+        const double bits = 1.2 * -n * std::log(p) / (ln2 * ln2);
+        blocks_m = std::max<std::size_t>(std::size_t(std::ceil(bits / block_bits)), 1);
+        hashes_m = std::min<std::size_t>(std::max<std::size_t>(std::size_t(std::lround(-std::log(p) / ln2)), 1), 16);
+        words_m.reset(new std::atomic<std::uint64_t>[blocks_m * block_words]);
+        clear();
+      }
+      ///
+      /// Copies the bits as they are, which is only consistent while
+      /// nothing is being added.
+      ///
+      inline bloom_filter_t(const bloom_filter_t& o)
+        : blocks_m(o.blocks_m)
+        , hashes_m(o.hashes_m)
+        , words_m(new std::atomic<std::uint64_t>[blocks_m * block_words])
+      {
+        for (std::size_t i = 0; i < blocks_m * block_words; ++i) {
+          words_m[i].store(o.words_m[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+      }
+      bloom_filter_t(bloom_filter_t&&) = default;
+      inline bloom_filter_t& operator=(bloom_filter_t o) {
+        std::swap(blocks_m, o.blocks_m);
+        std::swap(hashes_m, o.hashes_m);
+        std::swap(words_m, o.words_m);
+        return *this;
+      }
+      ///
+      /// Forgets all keys; not safe while other threads use the filter.
+      ///
+      inline void clear() {
+        for (std::size_t i = 0; i < blocks_m * block_words; ++i) {
+          words_m[i].store(0, std::memory_order_relaxed);
+        }
+      }
+      inline void insert(std::uint64_t hash) {
+        std::atomic<std::uint64_t>* block = block_for(hash);
+        std::uint64_t bits = 0;
+        for (std::size_t i = 0; i < hashes_m; ++i) {
+          const std::size_t bit = next_bit(bits, hash, i);
+          block[bit >> 6].fetch_or(std::uint64_t(1) << (bit & 63), std::memory_order_relaxed);
+        }
+      }
+      inline bool contains(std::uint64_t hash) const {
+        const std::atomic<std::uint64_t>* block = block_for(hash);
+        std::uint64_t bits = 0;
+        for (std::size_t i = 0; i < hashes_m; ++i) {
+          const std::size_t bit = next_bit(bits, hash, i);
+          if ((block[bit >> 6].load(std::memory_order_relaxed) & (std::uint64_t(1) << (bit & 63))) == 0) {
+            return false;
+          }
+        }
+        return true;
+      }
+      inline std::size_t bits() const { return blocks_m * block_bits; }
+      inline std::size_t hashes() const { return hashes_m; }
+    private:
+      static const std::size_t block_bits = 512;
+      static const std::size_t block_words = block_bits / 64;
+      std::size_t blocks_m;
+      std::size_t hashes_m;
+      std::unique_ptr<std::atomic<std::uint64_t>[]> words_m;
+      inline std::atomic<std::uint64_t>* block_for(std::uint64_t hash) const {
+        hash = (hash ^ (hash >> 29)) * 0x94d049bb133111ebULL;
+        return &words_m[((hash >> 32) * blocks_m >> 32) * block_words];
+      }
+      // Mixes the lower half of the hash with a round number into 64
+      // fresh bits, so that every round draws independent bits.
+      static inline std::uint64_t spread(std::uint64_t hash, std::size_t round) {
+        std::uint64_t z = (hash & 0xffffffffULL) + (round + 1) * 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+      }
+      // Takes 9 bits at a time, seven to a round, starting a new round
+      // from the hash when they run out.
+      static inline std::size_t next_bit(std::uint64_t& bits, std::uint64_t hash, std::size_t i) {
+        if (i % 7 == 0) {
+          bits = spread(hash, i / 7);
+        }
+        const std::size_t bit = std::size_t(bits >> 55);
+        bits <<= 9;
+        return bit;
+      }
+    }; // bloom_filter_t
+    ///
+    /// Puts a Bloom filter of every key for which a predicate holds
+    /// in front of the predicate, so that most keys for which it does
+    /// not hold are rejected without calling it. Answers are exact,
+    /// provided every such key has been added with
+    /// <code>insert</code>.
+    ///
+    template<typename Key, typename Pred>
+    class bloom_guard_t {
+    public:
+      inline bloom_guard_t(Pred pred, std::size_t expected, double fp_rate)
+        : pred_m(std::move(pred))
+        , filter_m(new bloom_filter_t(expected, fp_rate))
+      {}
+      inline void insert(const Key& key) { filter_m->insert(mixed_hash(key)); }
+      inline bool operator()(const Key& key) const {
+        return filter_m->contains(mixed_hash(key)) && bool(pred_m(key));
+      }
+      inline const bloom_filter_t& filter() const { return *filter_m; }
+    private:
+      Pred pred_m;
+      std::unique_ptr<bloom_filter_t> filter_m;
+    }; // bloom_guard_t
+    ///
+    /// Remembers the keys for which a predicate did not hold in a
+    /// Bloom filter, and answers false for them without calling the
+    /// predicate again.
+    ///
+    /// This trades accuracy for speed: a key for which the predicate
+    /// holds is wrongly rejected at about the false positive rate of
+    /// the filter (more once it holds more keys than expected), and a
+    /// key stays rejected even if the predicate would hold for it
+    /// later on.
+    ///
+    template<typename Key, typename Pred>
+    class negative_cache_t {
+    public:
+      inline negative_cache_t(Pred pred, std::size_t expected, double fp_rate)
+        : pred_m(std::move(pred))
+        , filter_m(new bloom_filter_t(expected, fp_rate))
+      {}
+      inline bool operator()(const Key& key) const {
+        const std::uint64_t hash = mixed_hash(key);
+        if (filter_m->contains(hash)) {
+          return false;
+        }
+        const bool result = bool(pred_m(key));
+        if (! result) {
+          filter_m->insert(hash);
+        }
+        return result;
+      }
+      inline const bloom_filter_t& filter() const { return *filter_m; }
+    private:
+      Pred pred_m;
+      std::unique_ptr<bloom_filter_t> filter_m;
+    }; // negative_cache_t
+    ///
+    /// An open addressing set of 64 bit key hashes (fingerprints),
+    /// probed linearly at most half full. Keys themselves are never
+    /// stored, so a key of any size costs 16 bytes or less, and two
+    /// keys are only mistaken for each other if their 64 bit hashes
+    /// collide.
+    ///
+    class fingerprint_set_t {
+    public:
+      inline fingerprint_set_t() : size_m(0), slots_m(16, 0) {}
+      ///
+      /// Adds a fingerprint, and returns whether it was new.
+      ///
+      inline bool insert(std::uint64_t hash) {
+        // Zero marks empty slots.
+        hash = hash == 0 ? 1 : hash;
+        std::size_t mask = slots_m.size() - 1;
+        for (std::size_t i = std::size_t(hash) & mask;; i = (i + 1) & mask) {
+          if (slots_m[i] == hash) {
+            return false;
+          }
+          if (slots_m[i] == 0) {
+            slots_m[i] = hash;
+            if (2 * ++size_m > slots_m.size()) {
+              grow();
+            }
+            return true;
+          }
+        }
+      }
+      inline std::size_t size() const { return size_m; }
+    private:
+      std::size_t size_m;
+      std::vector<std::uint64_t> slots_m;
+      inline void grow() {
+        std::vector<std::uint64_t> old(2 * slots_m.size(), 0);
+        old.swap(slots_m);
+        const std::size_t mask = slots_m.size() - 1;
+        for (std::uint64_t hash : old) {
+          if (hash != 0) {
+            std::size_t i = std::size_t(hash) & mask;
+            while (slots_m[i] != 0) {
+              i = (i + 1) & mask;
+            }
+            slots_m[i] = hash;
+          }
+        }
+      }
+    }; // fingerprint_set_t
+    ///
+    /// Tells whether a key is seen for the first time, exactly (up to
+    /// collisions of 64 bit hashes), remembering every key it has
+    /// seen as a fingerprint. Memory is not bounded: it grows by up to
+    /// 16 bytes per distinct key, for as long as the filter lives.
+    ///
+    template<typename KeyFn>
+    class distinct_t {
+    public:
+      typedef KeyFn key_fn_type;
+      inline explicit distinct_t(KeyFn key_fn) : key_fn_m(std::move(key_fn)) {}
+      ///
+      /// An empty filter like this one, for one of <code>n</code>
+      /// shards that split the keys between them.
+      ///
+      inline distinct_t for_shard(std::size_t) const { return distinct_t(key_fn_m); }
+      template<typename T>
+      inline bool operator()(const T& x) {
+        return seen_m.insert(mixed_hash(key_fn_m(x)));
+      }
+      inline std::size_t size() const { return seen_m.size(); }
+      inline const KeyFn& key_fn() const { return key_fn_m; }
+    private:
+      KeyFn key_fn_m;
+      fingerprint_set_t seen_m;
+    }; // distinct_t
+    ///
+    /// Tells whether a key has not been seen recently, remembering
+    /// keys in two Bloom filters that take turns: keys go into the
+    /// current one, both are checked, and every <code>span</code> the
+    /// previous one is cleared and becomes the current one. A key is
+    /// thus remembered for between one and two spans after it was
+    /// last seen, and memory stays fixed however many keys go by. A
+    /// new key is mistaken for a duplicate at about the false positive
+    /// rate, as long as no more than the expected number of keys go by
+    /// per span.
+    ///
+    template<typename KeyFn>
+    class distinct_for_t {
+    public:
+      typedef KeyFn key_fn_type;
+      typedef std::chrono::steady_clock clock_type;
+      inline distinct_for_t(KeyFn key_fn, clock_type::duration span, std::size_t expected, double fp_rate)
+        : key_fn_m(std::move(key_fn))
+        , span_m(span)
+        , expected_m(expected)
+        , fp_rate_m(fp_rate)
+        , current_m(expected, fp_rate)
+        , previous_m(expected, fp_rate)
+        , rotated_m()
+        , started_m(false)
+      {}
+      ///
+      /// An empty filter like this one, for one of <code>n</code>
+      /// shards that split the keys between them, and so sized for a
+      /// <code>n</code>th of the expected keys.
+      ///
+      inline distinct_for_t for_shard(std::size_t n) const {
+        n = std::max<std::size_t>(n, 1);
+        return distinct_for_t(key_fn_m, span_m, (expected_m + n - 1) / n, fp_rate_m);
+      }
+      ///
+      /// Checks a key observed at time <code>t</code>, which should
+      /// not be earlier than any previous one.
+      ///
+      template<typename T>
+      inline bool operator()(clock_type::time_point t, const T& x) {
+        if (! started_m) {
+          rotated_m = t;
+          started_m = true;
+        } else if (rotated_m + span_m <= t) {
+          if (rotated_m + 2 * span_m <= t) {
+            previous_m.clear();
+          } else {
+            std::swap(current_m, previous_m);
+          }
+          current_m.clear();
+          rotated_m = t;
+        }
+        const std::uint64_t hash = mixed_hash(key_fn_m(x));
+        const bool seen = current_m.contains(hash) || previous_m.contains(hash);
+        current_m.insert(hash);
+        return ! seen;
+      }
+      ///
+      /// Checks a key observed now.
+      ///
+      template<typename T>
+      inline bool operator()(const T& x) {
+        return (*this)(clock_type::now(), x);
+      }
+      inline const KeyFn& key_fn() const { return key_fn_m; }
+    private:
+      KeyFn key_fn_m;
+      clock_type::duration span_m;
+      std::size_t expected_m;
+      double fp_rate_m;
+      bloom_filter_t current_m;
+      bloom_filter_t previous_m;
+      clock_type::time_point rotated_m;
+      bool started_m;
+    }; // distinct_for_t
+    ///
+    /// Passes on the inputs that a filter lets through.
+    ///
+    template<typename Filter, typename Sink>
+    struct dedup_t {
+      Filter filter;
+      Sink sink;
+      template<typename T>
+      inline void operator()(const T& x) {
+        if (filter(x)) {
+          sink(x);
+        }
+      }
+    }; // dedup_t
+  } // namespace funtup_helper
+
+  ///
+  /// Builds a sink that broadcasts every input of type
+  /// <code>T</code> to several branches (typically pipes), each
+  /// running concurrently on its own thread and reading the same
+  /// shared, immutable copy of the input. Each branch has a queue of
+  /// <code>capacity</code> inputs; when it is full, the tee waits.
+  /// Call <code>flush()</code> to wait for the branches to catch up.
+  ///
+  /*!\code
+    auto t = tee<document>(1024, pipe(index_words(), store()),
+                                 pipe(extract_links(), crawl()),
+                                 count_bytes());
+    for (const std::string& raw : input) { t(parse(raw)); }
+    t.flush();
+  \endcode*/
+  template<typename T, typename... Branches>
+  inline funtup_helper::tee_t<T, Branches...>
+  tee(std::size_t capacity, Branches&&... branches) {
+    return funtup_helper::tee_t<T, Branches...>(capacity, std::forward<Branches>(branches)...);
+  }
+  ///
+  /// Builds a sink that routes every input of type <code>T</code> to
+  /// one of <code>n</code> shards by the hash of
+  /// <code>key_fn(input)</code>. Shard <code>i</code> is
+  /// <code>factory(i)</code> (typically a pipe), and runs on a thread
+  /// of its own behind a queue of <code>capacity</code> inputs, so
+  /// that state kept per key needs no locks.
+  ///
+  /*!\code
+    auto sessions = partition<event>([](const event& e) { return e.user; },
+                                     4, [](std::size_t) { return pipe(enrich(), sessionize()); });
+    for (const event& e : events) { sessions(e); }
+    sessions.flush();
+  \endcode*/
+  template<typename T, typename KeyFn, typename Factory>
+  inline funtup_helper::partition_t<T, KeyFn, typename std::decay<typename std::result_of<Factory&(std::size_t)>::type>::type>
+  partition(KeyFn key_fn, std::size_t n, Factory&& factory, std::size_t capacity = 1024) {
+    return funtup_helper::partition_t<T, KeyFn, typename std::decay<typename std::result_of<Factory&(std::size_t)>::type>::type>(std::move(key_fn), n, std::forward<Factory>(factory), capacity);
+  }
+  ///
+  /// Builds a stage that collects inputs of type <code>T</code> into
+  /// batches of up to <code>n</code>, waiting at most
+  /// <code>max_delay</code> after the first input of a batch, and
+  /// passes each batch to <code>batch_fn</code>, which takes a vector
+  /// of inputs and returns (or fills, through <code>call_into</code>)
+  /// a vector with one result per input. The result for each input
+  /// is passed to the continuation given along with it, and if the
+  /// batch fails, the exception is passed to the error continuation
+  /// given with it (or rethrown by <code>flush()</code>).
+  ///
+  /*!\code
+    auto lookup = batch_by<key>(64, std::chrono::milliseconds(2), multi_get());
+    lookup(k, [](const value& v) { use(v); });
+    lookup(k2, [](const value& v) { use(v); }, [](std::exception_ptr e) { report(e); });
+    lookup.flush();
+  \endcode*/
+  template<typename T, typename BatchFn, typename Rep, typename Period>
+  inline funtup_helper::batch_by_t<T, BatchFn>
+  batch_by(std::size_t n, std::chrono::duration<Rep, Period> max_delay, BatchFn batch_fn) {
+    return funtup_helper::batch_by_t<T, BatchFn>(n, std::chrono::duration_cast<std::chrono::steady_clock::duration>(max_delay), std::move(batch_fn));
+  }
+  ///
+  /// Wraps <code>func</code>, called with arguments of types
+  /// <code>Args...</code>, so that concurrent calls with equal
+  /// arguments (compared with <code>&lt;</code>) wait for one call
+  /// in flight and share its result or exception.
+  ///
+  /*!\code
+    auto fetch = coalesce<std::string>([&](const std::string& key) { return backend.get(key); });
+    // Called from many threads at once, backend.get("hot") runs once.
+    fetch("hot");
+  \endcode*/
+  template<typename... Args, typename Func>
+  inline funtup_helper::coalesce_t<typename std::decay<Func>::type, Args...>
+  coalesce(Func&& func) {
+    return funtup_helper::coalesce_t<typename std::decay<Func>::type, Args...>(std::forward<Func>(func));
+  }
+  ///
+  /// \name Bloom filtered predicates
+  ///
+  /// Wrap a predicate on keys of type <code>Key</code> that usually
+  /// does not hold (e.g. an expensive existence check) with a blocked
+  /// Bloom filter sized for <code>expected</code> keys at a false
+  /// positive rate of <code>fp_rate</code>. Both may be called from
+  /// many threads at once.
+  ///
+  /// \{
+  // ---------------------------------------------------------------------- //
+  ///
+  /// Builds a guard that rejects keys not added with
+  /// <code>insert</code> without calling <code>pred</code>.
+  ///
+  /*!\code
+    auto exists = bloom_guard<std::string>([&](const std::string& k) { return db.has(k); }, 1000000, 0.01);
+    for (const std::string& k : db.keys()) { exists.insert(k); }
+    exists("nope"); // almost certainly does not touch db
+  \endcode*/
+  template<typename Key, typename Pred>
+  inline funtup_helper::bloom_guard_t<Key, Pred>
+  bloom_guard(Pred pred, std::size_t expected, double fp_rate = 0.01) {
+    return funtup_helper::bloom_guard_t<Key, Pred>(std::move(pred), expected, fp_rate);
+  }
+  // ---------------------------------------------------------------------- //
+  ///
+  /// Builds a cache that learns the keys for which <code>pred</code>
+  /// does not hold, and wrongly rejects other keys at about
+  /// <code>fp_rate</code>.
+  ///
+  template<typename Key, typename Pred>
+  inline funtup_helper::negative_cache_t<Key, Pred>
+  negative_cache(Pred pred, std::size_t expected, double fp_rate = 0.001) {
+    return funtup_helper::negative_cache_t<Key, Pred>(std::move(pred), expected, fp_rate);
+  }
+  // ---------------------------------------------------------------------- //
+  /// \}
+  ///
+  /// \name Deduplication
+  ///
+  /// Stateful predicates that hold the first time they see the key
+  /// <code>key_fn(x)</code> of an input, to drop duplicates from a
+  /// stream before expensive stages.
+  ///
+  /// \{
+  // ---------------------------------------------------------------------- //
+  ///
+  /// Builds an exact filter, which keeps an 8 byte fingerprint of
+  /// every distinct key, in a table that grows without bound.
+  ///
+  /*!\code
+    auto fresh = distinct([](const event& e) { return e.id; });
+    for (const event& e : stream) { if (fresh(e)) { process(e); } }
+  \endcode*/
+  template<typename KeyFn>
+  inline funtup_helper::distinct_t<KeyFn> distinct(KeyFn key_fn) {
+    return funtup_helper::distinct_t<KeyFn>(std::move(key_fn));
+  }
+  // ---------------------------------------------------------------------- //
+  ///
+  /// Builds an approximate filter in fixed memory, which drops keys
+  /// seen during (at least) the last <code>span</code>, sized for
+  /// <code>expected</code> keys per span.
+  ///
+  template<typename KeyFn, typename Rep, typename Period>
+  inline funtup_helper::distinct_for_t<KeyFn>
+  distinct_for(KeyFn key_fn, std::chrono::duration<Rep, Period> span, std::size_t expected, double fp_rate = 0.001) {
+    return funtup_helper::distinct_for_t<KeyFn>
+      (std::move(key_fn), std::chrono::duration_cast<std::chrono::steady_clock::duration>(span), expected, fp_rate);
+  }
+  // ---------------------------------------------------------------------- //
+  ///
+  /// Builds a sink that deduplicates inputs of type <code>T</code> in
+  /// parallel: inputs are partitioned into <code>n</code> shards by
+  /// the hash of their key, each with its own filter
+  /// <code>filter.for_shard(n)</code> (so no key is checked in two
+  /// places, and a fixed memory filter is sized for the keys of one
+  /// shard) and a sink <code>sink_factory(i)</code> for the inputs
+  /// that pass.
+  ///
+  /*!\code
+    auto fresh = distinct_shards<event>(distinct([](const event& e) { return e.id; }), 4,
+                                        [](std::size_t) { return pipe(enrich(), store()); });
+  \endcode*/
+  template<typename T, typename Filter, typename SinkFactory>
+  inline funtup_helper::partition_t<T, typename Filter::key_fn_type,
+                                    funtup_helper::dedup_t<Filter, typename std::decay<typename std::result_of<SinkFactory&(std::size_t)>::type>::type> >
+  distinct_shards(const Filter& filter, std::size_t n, SinkFactory sink_factory, std::size_t capacity = 1024) {
+    typedef funtup_helper::dedup_t<Filter, typename std::decay<typename std::result_of<SinkFactory&(std::size_t)>::type>::type> shard_type;
+    return funtup_helper::partition_t<T, typename Filter::key_fn_type, shard_type>
+      (filter.key_fn(), n, [&](std::size_t i) { return shard_type{ filter.for_shard(n), sink_factory(i) }; }, capacity);
+  }
+  // ---------------------------------------------------------------------- //
+  /// \}
+
+} // namespace funtup
+} // namespace com_masaers
+
+#endif
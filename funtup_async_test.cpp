@@ -0,0 +1,261 @@
+#include "funtup_async.hpp"
+#include <cassert>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+
+struct session_count {
+  std::map<int, int> counts;
+  void operator()(const std::pair<int, int>& e) {
+    int& count = counts[e.first];
+    assert(count == e.second); // inputs with one key arrive in order
+    ++count;
+  }
+}; // session_count
+struct doubler {
+  int* calls;
+  void call_into(std::vector<int>& results, const std::vector<int>& xs) const {
+    ++*calls;
+    results.clear();
+    for (int x : xs) { results.push_back(2 * x); }
+  }
+  std::vector<int> operator()(const std::vector<int>& xs) const {
+    std::vector<int> results;
+    call_into(results, xs);
+    return results;
+  }
+}; // doubler
+
+int main(int argc, char** argv) {
+  using namespace com_masaers::funtup;
+  using namespace std;
+  
+  long total = 0;
+  size_t longest = 0;
+  vector<const vector<int>*> seen_a, seen_b;
+  {
+    auto t = tee<vector<int> >(4,
+                               pipe([](const vector<int>& v) { return accumulate(v.begin(), v.end(), 0L); },
+                                    [&total](long sum) { total += sum; }),
+                               [&longest](const vector<int>& v) { longest = max(longest, v.size()); },
+                               [&seen_a](const vector<int>& v) { seen_a.push_back(&v); },
+                               [&seen_b](const vector<int>& v) { seen_b.push_back(&v); });
+    for (int i = 1; i <= 100; ++i) {
+      t(vector<int>(i, i));
+    }
+    t.flush();
+    assert(total == 100L * 101L * 201L / 6);
+    assert(longest == 100);
+    assert(seen_a.size() == 100 && seen_a == seen_b);
+  }
+  
+  auto failing = tee<int>(16, [](int x) { if (x == 3) { throw runtime_error("three"); } });
+  for (int i = 0; i < 5; ++i) { failing(i); }
+  bool thrown = false;
+  try { failing.flush(); } catch (const runtime_error&) { thrown = true; }
+  assert(thrown);
+  failing.flush();
+  
+  auto sessions = partition<pair<int, int> >([](const pair<int, int>& e) { return e.first; },
+                                             3, [](size_t) { return session_count(); }, 8);
+  {
+    vector<thread> producers;
+    for (int p = 0; p < 3; ++p) {
+      producers.emplace_back([&sessions, p]() {
+          for (int n = 0; n < 50; ++n) {
+            for (int user = p; user < 30; user += 3) {
+              sessions(make_pair(user, n));
+            }
+          }
+        });
+    }
+    for (thread& producer : producers) { producer.join(); }
+  }
+  sessions.flush();
+  assert(sessions.size() == 3);
+  map<int, int> all;
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    for (const pair<const int, int>& count : sessions.shard(i).counts) {
+      assert(all.count(count.first) == 0); // every key lives in one shard
+      all.insert(count);
+    }
+  }
+  assert(all.size() == 30);
+  for (const pair<const int, int>& count : all) { assert(count.second == 50); }
+  
+  vector<vector<string> > outputs(2);
+  {
+    auto words = partition<string>([](const string& w) { return w; },
+                                   2, [&outputs](size_t i) {
+                                     return pipe([](const string& w) { return w + "!"; },
+                                                 [&outputs, i](const string& w) { outputs[i].push_back(w); });
+                                   });
+    for (const char* w : { "a", "b", "c", "a", "b", "a" }) { words(w); }
+  }
+  assert(outputs[0].size() + outputs[1].size() == 6);
+  for (const string& w : outputs[0]) {
+    assert(find(outputs[1].begin(), outputs[1].end(), w) == outputs[1].end());
+  }
+  assert(count(outputs[0].begin(), outputs[0].end(), "a!") + count(outputs[1].begin(), outputs[1].end(), "a!") == 3);
+  
+  int calls = 0;
+  vector<int> doubled(10, -1);
+  {
+    auto batched = batch_by<int>(4, chrono::hours(1), doubler{ &calls });
+    for (int i = 0; i < 10; ++i) {
+      batched(i, [&doubled, i](int y) { doubled[i] = y; });
+    }
+    assert(calls == 2 && doubled[7] == 14 && doubled[8] == -1);
+    batched.flush();
+    assert(calls == 3 && doubled[9] == 18);
+  }
+  
+  atomic<int> late(0);
+  auto timed = batch_by<int>(100, chrono::milliseconds(1), [](const vector<int>& xs) { return xs; });
+  timed(5, [&late](int y) { late = y; });
+  for (int i = 0; i < 5000 && late == 0; ++i) { this_thread::sleep_for(chrono::milliseconds(1)); }
+  assert(late == 5);
+  
+  auto short_fn = batch_by<int>(2, chrono::hours(1), [](const vector<int>&) { return vector<int>(); });
+  short_fn(1, [](int) {});
+  short_fn(2, [](int) {});
+  thrown = false;
+  try { short_fn.flush(); } catch (const length_error&) { thrown = true; }
+  assert(thrown);
+  
+  int answered = 0, failed = 0;
+  auto broken = batch_by<int>(3, chrono::hours(1), [](const vector<int>& xs) -> vector<int> {
+      if (xs.front() < 0) { throw invalid_argument("negative"); }
+      return xs;
+    });
+  for (int x : { -1, 2, 3 }) {
+    broken(x, [&answered](int) { ++answered; }, [&failed](exception_ptr) { ++failed; });
+  }
+  assert(answered == 0 && failed == 3);
+  broken.flush();
+  for (int x : { 1, 2, 3 }) {
+    broken(x, [&answered](int y) { ++answered; if (y == 1) { throw out_of_range("one"); } });
+  }
+  assert(answered == 3);
+  thrown = false;
+  try { broken.flush(); } catch (const out_of_range&) { thrown = true; }
+  assert(thrown);
+  
+  int first_calls = 0, second_calls = 0;
+  vector<int> moved_into;
+  {
+    auto first = batch_by<int>(4, chrono::hours(1), doubler{ &first_calls });
+    auto second = batch_by<int>(4, chrono::hours(1), doubler{ &second_calls });
+    first(1, [&moved_into](int y) { moved_into.push_back(y); });
+    first = move(second);
+    assert(first_calls == 1 && (moved_into == vector<int>{ 2 }));
+    first(5, [&moved_into](int y) { moved_into.push_back(y); });
+    first.flush();
+  }
+  assert(second_calls == 1 && (moved_into == vector<int>{ 2, 10 }));
+  
+  atomic<int> fetches(0), arrived(0);
+  auto fetch = coalesce<int, string>([&](int x, const string& suffix) {
+      ++fetches;
+      if (x < 0) { throw invalid_argument("negative"); }
+      while (arrived < 4) { this_thread::yield(); }
+      this_thread::sleep_for(chrono::milliseconds(50));
+      return to_string(x) + suffix;
+    });
+  {
+    vector<string> fetched(4);
+    vector<thread> callers;
+    for (int i = 0; i < 4; ++i) {
+      callers.emplace_back([&, i]() { ++arrived; fetched[i] = fetch(7, "!"); });
+    }
+    for (thread& caller : callers) { caller.join(); }
+    assert(fetches == 1);
+    assert(count(fetched.begin(), fetched.end(), "7!") == 4);
+    assert(fetch.in_flight() == 0);
+  }
+  assert(fetch(8, "?") == "8?" && fetches == 2);
+  for (int i = 0; i < 2; ++i) {
+    thrown = false;
+    try { fetch(-1, ""); } catch (const invalid_argument&) { thrown = true; }
+    assert(thrown);
+  }
+  assert(fetches == 4 && fetch.in_flight() == 0);
+  
+  atomic<int> checks(0);
+  auto small_even = bloom_guard<int>([&checks](int x) { ++checks; return x < 2000 && x % 2 == 0; }, 1000, 0.01);
+  {
+    vector<thread> loaders;
+    for (int t = 0; t < 4; ++t) {
+      loaders.emplace_back([&small_even, t]() { for (int x = 2 * t; x < 2000; x += 8) { small_even.insert(x); } });
+    }
+    for (thread& loader : loaders) { loader.join(); }
+  }
+  for (int x = 0; x < 20000; ++x) { assert(small_even(x) == (x < 2000 && x % 2 == 0)); }
+  assert(checks >= 1000 && checks < 1000 + 19000 / 50);
+  auto rare = bloom_guard<int>([](int) { return true; }, 100000, 1e-4);
+  for (int x = 0; x < 100000; ++x) { rare.insert(x); }
+  size_t false_positives = 0;
+  for (int x = 100000; x < 1100000; ++x) { false_positives += rare(x); }
+  assert(rare.filter().hashes() > 7 && false_positives < 120);
+  
+  checks = 0;
+  auto is_round = negative_cache<int>([&checks](int x) { ++checks; return x % 1000 == 0; }, 10000, 0.001);
+  for (int x = 0; x < 10000; ++x) { assert(! is_round(x) || x % 1000 == 0); }
+  const int first_checks = checks;
+  assert(first_checks > 9900);
+  int rounds = 0;
+  for (int x = 0; x < 10000; ++x) { rounds += is_round(x); }
+  assert(checks - first_checks <= 10 && rounds >= 9);
+  
+  auto fresh = distinct([](const string& s) { return s.substr(0, 2); });
+  vector<string> kept;
+  for (const char* w : { "apple", "apricot", "banana", "apex", "bandit", "cherry" }) {
+    if (fresh(string(w))) { kept.push_back(w); }
+  }
+  assert((kept == vector<string>{ "apple", "banana", "cherry" }) && fresh.size() == 3);
+  size_t unique = 0;
+  auto numbers = distinct([](int x) { return x; });
+  for (int i = 0; i < 100000; ++i) { unique += numbers((i * 7919) % 30011); }
+  assert(unique == 30011);
+  
+  const chrono::steady_clock::time_point t0;
+  auto recent = distinct_for([](int x) { return x; }, chrono::seconds(10), 1000);
+  assert(recent(t0, 1) && recent(t0 + chrono::seconds(1), 2));
+  assert(! recent(t0 + chrono::seconds(5), 1));
+  assert(! recent(t0 + chrono::seconds(12), 2)); // one span later, still remembered
+  assert(recent(t0 + chrono::seconds(40), 1) && recent(t0 + chrono::seconds(40), 2));
+  size_t passed = 0;
+  for (int i = 0; i < 1000; ++i) { passed += recent(t0 + chrono::seconds(41), 1000 + i); }
+  assert(passed > 990);
+  
+  vector<vector<int> > firsts(3);
+  {
+    auto dedup = distinct_shards<int>(distinct([](int x) { return x; }), 3,
+                                      [&firsts](size_t i) { return [&firsts, i](int x) { firsts[i].push_back(x); }; });
+    vector<thread> producers;
+    for (int p = 0; p < 3; ++p) {
+      producers.emplace_back([&dedup]() { for (int x = 0; x < 5000; ++x) { dedup(x % 700); } });
+    }
+    for (thread& producer : producers) { producer.join(); }
+    dedup.flush();
+  }
+  assert(firsts[0].size() + firsts[1].size() + firsts[2].size() == 700);
+  
+  atomic<size_t> fresh_keys(0);
+  {
+    auto dedup = distinct_shards<int>(distinct_for([](int x) { return x; }, chrono::hours(1), 20000), 4,
+                                      [&fresh_keys](size_t) { return [&fresh_keys](int) { ++fresh_keys; }; });
+    for (int x = 0; x < 20000; ++x) { dedup(x); }
+    dedup.flush();
+  }
+  assert(fresh_keys > 19900);
+  
+  return 0;
+}
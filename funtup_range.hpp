@@ -0,0 +1,2692 @@
+#ifndef COM_MASAERS_FUNTUP_RANGE_HPP
+#define COM_MASAERS_FUNTUP_RANGE_HPP
+///
+/// \file
+///
+/// \brief Functors that take a whole range as their argument, to be
+/// used as stages in pipes over ranges.
+///
+#include "funtup.hpp"
+#include <vector>
+#include <deque>
+#include <iterator>
+#include <type_traits>
+#include <limits>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <unordered_map>
+#include <cmath>
+#include <random>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+namespace com_masaers {
+namespace funtup {
+  namespace funtup_helper {
+    ///
+    /// The type of the elements of a range.
+    ///
+    template<typename Range>
+    struct range_value {
+      typedef typename std::iterator_traits<decltype(std::begin(std::declval<const Range&>()))>::value_type type;
+    };
+    ///
+    /// Whether the elements of a range can be indexed, rather than
+    /// only read one after another.
+    ///
+    template<typename Range>
+    struct is_random_access_range
+      : std::is_base_of<std::random_access_iterator_tag,
+                        typename std::iterator_traits<decltype(std::begin(std::declval<const Range&>()))>::iterator_category>
+    {};
+    ///
+    /// How many elements a stage that runs in chunks of
+    /// <code>grain</code> reads at a time from a range that is not
+    /// random access: a few chunks for every thread.
+    ///
+    inline std::size_t block_for(std::size_t grain) {
+      return grain * max_threads() * 4;
+    }
+    ///
+    /// How many elements a stage that runs on the calling thread reads
+    /// at a time from a range that is not random access.
+    ///
+    const std::size_t serial_block = 4096;
+    ///
+    /// Reads a range in a single pass, <code>block</code> elements at
+    /// a time, and calls <code>func</code> with each block (as a
+    /// vector, which can be indexed) in order. This is how stages that
+    /// index their range take input ranges, such as the result of
+    /// <code>sort_by</code>, while holding no more than a block of it
+    /// in memory.
+    ///
+    template<typename Range, typename Func>
+    inline void for_each_block(const Range& range, std::size_t block, const Func& func) {
+      std::vector<typename range_value<Range>::type> buffer;
+      buffer.reserve(block);
+      auto it = std::begin(range);
+      const auto last = std::end(range);
+      while (it != last) {
+        buffer.clear();
+        for (; it != last && buffer.size() < block; ++it) {
+          buffer.push_back(*it);
+        }
+        func(buffer);
+      }
+    }
+    ///
+    /// Reduces a range with a fixed-shape tree, so that the result
+    /// does not depend on how many threads took part.
+    ///
+    /// The range is cut into leaves of <code>leaf</code> elements.
+    /// Within a leaf, elements are spread round robin over
+    /// <code>lanes</code> independent accumulators, which gives the
+    /// compiler a loop it can vectorize, and the accumulators are then
+    /// combined pairwise. The leaves are reduced in parallel, and the
+    /// leaf results are combined pairwise as well. Every step only
+    /// depends on the length of the range, so a non-associative
+    /// operator such as floating point addition gives bit-identical
+    /// results from one run or machine to the next.
+    ///
+    template<typename Op, typename T>
+    class fold_t {
+    public:
+      static const std::size_t lanes = 8;
+      inline fold_t(Op&& op, T identity, std::size_t leaf)
+        : op_m(std::forward<Op>(op))
+        , identity_m(std::move(identity))
+        , leaf_m((std::max(leaf, std::size_t(lanes)) + lanes - 1) / lanes * lanes)
+      {}
+      template<typename Range>
+      inline T operator()(const Range& range) const {
+        std::vector<T> partial;
+        apply(range, partial, is_random_access_range<Range>());
+        return reduce_tree(partial.data(), partial.size());
+      }
+    private:
+      Op op_m;
+      T identity_m;
+      std::size_t leaf_m;
+      template<typename Range>
+      inline void apply(const Range& range, std::vector<T>& partial, std::true_type) const {
+        const auto first = std::begin(range);
+        reduce_leaves(partial, first, std::distance(first, std::end(range)));
+      }
+      // Blocks are whole numbers of leaves, so the leaves (and the
+      // tree over them) are the same as for a random access range.
+      template<typename Range>
+      inline void apply(const Range& range, std::vector<T>& partial, std::false_type) const {
+        for_each_block(range, block_for(leaf_m), [&](const std::vector<typename range_value<Range>::type>& block) {
+            reduce_leaves(partial, block.begin(), block.size());
+          });
+      }
+      ///
+      /// Appends the results of the leaves of <code>n</code> elements
+      /// to <code>partial</code>.
+      ///
+      template<typename It>
+      inline void reduce_leaves(std::vector<T>& partial, It first, std::size_t n) const {
+        const std::size_t at = partial.size();
+        const std::size_t leaves = (n + leaf_m - 1) / leaf_m;
+        partial.resize(at + leaves, identity_m);
+        parallel_chunks(leaves, 1, [&](std::size_t, std::size_t begin, std::size_t end) {
+            for (std::size_t l = begin; l < end; ++l) {
+              partial[at + l] = reduce_leaf(first + l * leaf_m, std::min(leaf_m, n - l * leaf_m));
+            }
+          });
+      }
+      template<typename It>
+      inline T reduce_leaf(It it, std::size_t n) const {
+        T lane[lanes];
+        for (std::size_t j = 0; j < lanes; ++j) {
+          lane[j] = identity_m;
+        }
+        std::size_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+          for (std::size_t j = 0; j < lanes; ++j) {
+            lane[j] = op_m(lane[j], it[i + j]);
+          }
+        }
+        for (std::size_t j = 0; i < n; ++i, ++j) {
+          lane[j] = op_m(lane[j], it[i]);
+        }
+        return reduce_tree(lane, lanes);
+      }
+      inline T reduce_tree(T* values, std::size_t n) const {
+        if (n == 0) {
+          return identity_m;
+        }
+        for (std::size_t width = 1; width < n; width *= 2) {
+          for (std::size_t i = 0; i + width < n; i += 2 * width) {
+            values[i] = op_m(values[i], values[i + width]);
+          }
+        }
+        return values[0];
+      }
+    }; // fold_t
+    ///
+    /// Computes the inclusive prefix scan of a range in parallel.
+    ///
+    /// The range is cut into one block per thread. The first pass
+    /// scans the first block and reduces each of the others to a
+    /// single value; the block totals are then combined into the
+    /// carry going into each block, and the second pass scans the
+    /// remaining blocks starting from their carries. For an
+    /// associative operator the output is the same as a serial
+    /// <code>std::partial_sum</code> (or
+    /// <code>std::inclusive_scan</code>).
+    ///
+    template<typename Op>
+    class scan_t {
+    public:
+      inline scan_t(Op&& op, std::size_t grain)
+        : op_m(std::forward<Op>(op))
+        , grain_m(std::max<std::size_t>(grain, 1))
+      {}
+      ///
+      /// Scans the range into <code>result</code>, which is resized
+      /// to the length of the range.
+      ///
+      template<typename Range, typename T>
+      inline void call_into(std::vector<T>& result, const Range& range) const {
+        result.clear();
+        apply(result, range, is_random_access_range<Range>());
+      }
+      template<typename Range>
+      inline std::vector<typename range_value<Range>::type> operator()(const Range& range) const {
+        std::vector<typename range_value<Range>::type> result;
+        call_into(result, range);
+        return result;
+      }
+    private:
+      Op op_m;
+      std::size_t grain_m;
+      template<typename Range, typename T>
+      inline void apply(std::vector<T>& result, const Range& range, std::true_type) const {
+        const auto first = std::begin(range);
+        scan_block(result, first, std::distance(first, std::end(range)));
+      }
+      template<typename Range, typename T>
+      inline void apply(std::vector<T>& result, const Range& range, std::false_type) const {
+        for_each_block(range, block_for(grain_m), [&](const std::vector<typename range_value<Range>::type>& block) {
+            scan_block(result, block.begin(), block.size());
+          });
+      }
+      ///
+      /// Appends the scan of <code>n</code> elements to
+      /// <code>result</code>, carrying on from its last element.
+      ///
+      template<typename It, typename T>
+      inline void scan_block(std::vector<T>& result, It first, std::size_t n) const {
+        if (n == 0) {
+          return;
+        }
+        const std::size_t at = result.size();
+        result.resize(at + n);
+        std::vector<T> carry(chunk_count(n, grain_m));
+        parallel_chunks(n, grain_m, [&](std::size_t c, std::size_t begin, std::size_t end) {
+            T acc = c == 0 && at != 0 ? T(op_m(result[at - 1], first[begin])) : T(first[begin]);
+            if (c == 0) {
+              result[at + begin] = acc;
+            }
+            for (std::size_t i = begin + 1; i < end; ++i) {
+              acc = op_m(acc, first[i]);
+              if (c == 0) {
+                result[at + i] = acc;
+              }
+            }
+            carry[c] = acc;
+          });
+        for (std::size_t c = 1; c < carry.size(); ++c) {
+          carry[c] = op_m(carry[c - 1], carry[c]);
+        }
+        parallel_chunks(n, grain_m, [&](std::size_t c, std::size_t begin, std::size_t end) {
+            if (c == 0) {
+              return;
+            }
+            T acc = carry[c - 1];
+            for (std::size_t i = begin; i < end; ++i) {
+              acc = op_m(acc, first[i]);
+              result[at + i] = acc;
+            }
+          });
+      }
+    }; // scan_t
+
+
+    ///
+    /// \name Reducers
+    ///
+    /// A reducer describes how to aggregate a sequence of values,
+    /// while the partial aggregate itself is kept in a separate state
+    /// object. This lets the same (const) reducer be shared between
+    /// threads, windows and keys that each keep their own state. A
+    /// reducer provides:
+    ///
+    /// - <code>state_type</code>, the partial aggregate,
+    /// - <code>state_type init() const</code>, the aggregate of nothing,
+    /// - <code>void accumulate(state_type& s, const T& x) const</code>,
+    ///   which adds a value to the aggregate,
+    /// - <code>void merge(state_type& s, const state_type& o) const</code>,
+    ///   which adds the values aggregated in <code>o</code> to
+    ///   <code>s</code>, where <code>o</code> holds later values than
+    ///   <code>s</code>,
+    /// - <code>result(const state_type& s) const</code>, which returns
+    ///   the aggregate value,
+    ///
+    /// and, if merging can be undone,
+    ///
+    /// - <code>void unmerge(state_type& s, const state_type& o) const</code>,
+    ///   which removes the earliest values in <code>s</code>, that were
+    ///   aggregated in <code>o</code>,
+    ///
+    /// and, if states accumulated apart should differ from the start
+    /// (because they draw random numbers, say),
+    ///
+    /// - <code>state_type init(std::uint64_t stream) const</code>, the
+    ///   aggregate of nothing for part number <code>stream</code> of a
+    ///   parallel reduction, which <code>reduce</code> and
+    ///   <code>group_by</code> number by chunk (and key),
+    ///
+    /// and, if single values can be taken out again without a state
+    /// of their own,
+    ///
+    /// - <code>value_type</code>, the type of the values,
+    /// - <code>void unaccumulate(state_type& s, const value_type& x) const</code>,
+    ///   which removes the earliest value in <code>s</code>, that was
+    ///   <code>x</code>.
+    ///
+    /// A result may be a reference into the state, which saves copying
+    /// large states that are their own result (such as sketches).
+    ///
+    /// A battery of reducers is itself a reducer, whose state and
+    /// result are tuples; <code>reducer_ops</code> hides the
+    /// difference.
+    ///
+    /// \{
+    // ---------------------------------------------------------------------- //
+    ///
+    /// Meta function that determines whether a reducer can unmerge.
+    ///
+    template<typename Reducer, typename = void>
+    struct has_unmerge : public std::false_type {};
+    template<typename Reducer>
+    struct has_unmerge<Reducer, decltype(std::declval<const Reducer&>().unmerge(std::declval<typename Reducer::state_type&>(), std::declval<const typename Reducer::state_type&>()))>
+      : public std::true_type
+    {};
+    ///
+    /// Meta function that determines whether a reducer starts parts
+    /// of a parallel reduction from different states.
+    ///
+    template<typename Reducer, typename = void>
+    struct has_stream_init : public std::false_type {};
+    template<typename Reducer>
+    struct has_stream_init<Reducer, typename std::conditional<true, void, decltype(std::declval<const Reducer&>().init(std::uint64_t(0)))>::type>
+      : public std::true_type
+    {};
+    ///
+    /// Calls <code>init(stream)</code> where there is one, and
+    /// <code>init()</code> otherwise.
+    ///
+    template<typename Reducer>
+    inline typename Reducer::state_type init_stream(const Reducer& r, std::uint64_t stream, std::true_type) {
+      return r.init(stream);
+    }
+    template<typename Reducer>
+    inline typename Reducer::state_type init_stream(const Reducer& r, std::uint64_t, std::false_type) {
+      return r.init();
+    }
+    ///
+    /// Meta function that determines whether a reducer can
+    /// unaccumulate single values.
+    ///
+    template<typename Reducer, typename = void>
+    struct has_unaccumulate : public std::false_type {};
+    template<typename Reducer>
+    struct has_unaccumulate<Reducer, decltype(std::declval<const Reducer&>().unaccumulate(std::declval<typename Reducer::state_type&>(), std::declval<const typename Reducer::value_type&>()))>
+      : public std::true_type
+    {};
+    ///
+    /// The type of the values a reducer can unaccumulate, or
+    /// <code>void</code>.
+    ///
+    template<typename Reducer, bool Removable = has_unaccumulate<Reducer>::value>
+    struct removable_value { typedef void type; };
+    template<typename Reducer>
+    struct removable_value<Reducer, true> { typedef typename Reducer::value_type type; };
+    ///
+    /// Operations on a single reducer. The <code>view_type</code> is
+    /// what the reducer returns as its result, which may refer to the
+    /// state, and the <code>result_type</code> is a copy of it that
+    /// can outlive the state.
+    ///
+    template<typename Reducer>
+    struct reducer_ops {
+      typedef typename Reducer::state_type state_type;
+      typedef decltype(std::declval<const Reducer&>().result(std::declval<const state_type&>())) view_type;
+      typedef typename std::decay<view_type>::type result_type;
+      typedef typename removable_value<Reducer>::type value_type;
+      static const bool invertible = has_unmerge<Reducer>::value;
+      static const bool removable = has_unaccumulate<Reducer>::value;
+      static inline state_type init(const Reducer& r) {
+        return r.init();
+      }
+      static inline state_type init(const Reducer& r, std::uint64_t stream) {
+        return init_stream(r, stream, has_stream_init<Reducer>());
+      }
+      template<typename T>
+      static inline void accumulate(const Reducer& r, state_type& s, const T& x) {
+        r.accumulate(s, x);
+      }
+      static inline void merge(const Reducer& r, state_type& s, const state_type& o) {
+        r.merge(s, o);
+      }
+      static inline void unmerge(const Reducer& r, state_type& s, const state_type& o) {
+        r.unmerge(s, o);
+      }
+      template<typename T>
+      static inline void unaccumulate(const Reducer& r, state_type& s, const T& x) {
+        r.unaccumulate(s, x);
+      }
+      static inline view_type result(const Reducer& r, const state_type& s) {
+        return r.result(s);
+      }
+    }; // reducer_ops
+    ///
+    /// Meta function that determines whether all of a pack of
+    /// reducers can unmerge.
+    ///
+    template<typename... Reducers> struct all_invertible : public std::true_type {};
+    template<typename Reducer, typename... Reducers>
+    struct all_invertible<Reducer, Reducers...>
+      : public std::integral_constant<bool, reducer_ops<Reducer>::invertible && all_invertible<Reducers...>::value>
+    {};
+    ///
+    /// Meta function that determines whether all of a pack of
+    /// reducers can unaccumulate values of the same type, which is
+    /// then the <code>type</code>.
+    ///
+    template<typename... Reducers> struct all_removable : public std::false_type { typedef void type; };
+    template<typename Reducer>
+    struct all_removable<Reducer>
+      : public std::integral_constant<bool, reducer_ops<Reducer>::removable>
+    { typedef typename reducer_ops<Reducer>::value_type type; };
+    template<typename Reducer, typename... Reducers>
+    struct all_removable<Reducer, Reducers...>
+      : public std::integral_constant<bool, reducer_ops<Reducer>::removable
+                                      && all_removable<Reducers...>::value
+                                      && std::is_same<typename reducer_ops<Reducer>::value_type, typename all_removable<Reducers...>::type>::value>
+    { typedef typename reducer_ops<Reducer>::value_type type; };
+    ///
+    /// Operations on a battery of reducers, applied memberwise.
+    ///
+    template<typename... Reducers>
+    struct reducer_ops<battery_t<Reducers...> > {
+      typedef battery_t<Reducers...> reducer_type;
+      typedef std::tuple<typename reducer_ops<typename std::decay<Reducers>::type>::state_type...> state_type;
+      typedef std::tuple<typename reducer_ops<typename std::decay<Reducers>::type>::view_type...> view_type;
+      typedef std::tuple<typename reducer_ops<typename std::decay<Reducers>::type>::result_type...> result_type;
+      typedef typename all_removable<typename std::decay<Reducers>::type...>::type value_type;
+      static const bool invertible = all_invertible<typename std::decay<Reducers>::type...>::value;
+      static const bool removable = all_removable<typename std::decay<Reducers>::type...>::value;
+      static inline state_type init(const reducer_type& r) {
+        return init(r, make_seq<Reducers...>());
+      }
+      static inline state_type init(const reducer_type& r, std::uint64_t stream) {
+        return init(r, stream, make_seq<Reducers...>());
+      }
+      template<typename T>
+      static inline void accumulate(const reducer_type& r, state_type& s, const T& x) {
+        accumulate(r, s, x, make_seq<Reducers...>());
+      }
+      static inline void merge(const reducer_type& r, state_type& s, const state_type& o) {
+        merge(r, s, o, make_seq<Reducers...>());
+      }
+      static inline void unmerge(const reducer_type& r, state_type& s, const state_type& o) {
+        unmerge(r, s, o, make_seq<Reducers...>());
+      }
+      template<typename T>
+      static inline void unaccumulate(const reducer_type& r, state_type& s, const T& x) {
+        unaccumulate(r, s, x, make_seq<Reducers...>());
+      }
+      static inline view_type result(const reducer_type& r, const state_type& s) {
+        return result(r, s, make_seq<Reducers...>());
+      }
+    private:
+      template<int I>
+      struct ops : public reducer_ops<typename std::decay<typename std::tuple_element<I, std::tuple<Reducers...> >::type>::type> {};
+      template<int... I>
+      static inline state_type init(const reducer_type& r, seq<I...>) {
+        return state_type(ops<I>::init(std::get<I>(r))...);
+      }
+      template<int... I>
+      static inline state_type init(const reducer_type& r, std::uint64_t stream, seq<I...>) {
+        return state_type(ops<I>::init(std::get<I>(r), stream)...);
+      }
+      template<typename T, int... I>
+      static inline void accumulate(const reducer_type& r, state_type& s, const T& x, seq<I...>) {
+        const int expand[] = { 0, (ops<I>::accumulate(std::get<I>(r), std::get<I>(s), x), 0)... };
+        (void)expand;
+      }
+      template<int... I>
+      static inline void merge(const reducer_type& r, state_type& s, const state_type& o, seq<I...>) {
+        const int expand[] = { 0, (ops<I>::merge(std::get<I>(r), std::get<I>(s), std::get<I>(o)), 0)... };
+        (void)expand;
+      }
+      template<int... I>
+      static inline void unmerge(const reducer_type& r, state_type& s, const state_type& o, seq<I...>) {
+        const int expand[] = { 0, (ops<I>::unmerge(std::get<I>(r), std::get<I>(s), std::get<I>(o)), 0)... };
+        (void)expand;
+      }
+      template<typename T, int... I>
+      static inline void unaccumulate(const reducer_type& r, state_type& s, const T& x, seq<I...>) {
+        const int expand[] = { 0, (ops<I>::unaccumulate(std::get<I>(r), std::get<I>(s), x), 0)... };
+        (void)expand;
+      }
+      template<int... I>
+      static inline view_type result(const reducer_type& r, const state_type& s, seq<I...>) {
+        return view_type(ops<I>::result(std::get<I>(r), std::get<I>(s))...);
+      }
+    }; // reducer_ops<battery_t>
+    ///
+    /// Counts the values.
+    ///
+    struct count_t {
+      typedef std::size_t state_type;
+      inline state_type init() const { return 0; }
+      template<typename T>
+      inline void accumulate(state_type& s, const T&) const { ++s; }
+      inline void merge(state_type& s, const state_type& o) const { s += o; }
+      inline void unmerge(state_type& s, const state_type& o) const { s -= o; }
+      inline std::size_t result(const state_type& s) const { return s; }
+    }; // count_t
+    ///
+    /// Sums the values.
+    ///
+    template<typename T>
+    struct sum_t {
+      typedef T state_type;
+      inline state_type init() const { return T(); }
+      inline void accumulate(state_type& s, const T& x) const { s += x; }
+      inline void merge(state_type& s, const state_type& o) const { s += o; }
+      inline void unmerge(state_type& s, const state_type& o) const { s -= o; }
+      inline T result(const state_type& s) const { return s; }
+    }; // sum_t
+    ///
+    /// Averages the values, the mean of no values is zero.
+    ///
+    template<typename T>
+    struct mean_t {
+      typedef std::pair<T, std::size_t> state_type;
+      inline state_type init() const { return state_type(T(), 0); }
+      inline void accumulate(state_type& s, const T& x) const { s.first += x; ++s.second; }
+      inline void merge(state_type& s, const state_type& o) const { s.first += o.first; s.second += o.second; }
+      inline void unmerge(state_type& s, const state_type& o) const { s.first -= o.first; s.second -= o.second; }
+      inline T result(const state_type& s) const { return s.second == 0 ? T() : s.first / T(s.second); }
+    }; // mean_t
+    ///
+    /// The smallest value, or the largest possible value if there
+    /// are none. Cannot be unmerged.
+    ///
+    template<typename T>
+    struct min_t {
+      typedef T state_type;
+      inline state_type init() const { return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max(); }
+      inline void accumulate(state_type& s, const T& x) const { if (x < s) { s = x; } }
+      inline void merge(state_type& s, const state_type& o) const { accumulate(s, o); }
+      inline T result(const state_type& s) const { return s; }
+    }; // min_t
+    ///
+    /// The largest value, or the smallest possible value if there are
+    /// none. Cannot be unmerged.
+    ///
+    template<typename T>
+    struct max_t {
+      typedef T state_type;
+      inline state_type init() const { return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest(); }
+      inline void accumulate(state_type& s, const T& x) const { if (s < x) { s = x; } }
+      inline void merge(state_type& s, const state_type& o) const { accumulate(s, o); }
+      inline T result(const state_type& s) const { return s; }
+    }; // max_t
+    // ---------------------------------------------------------------------- //
+    /// \}
+
+
+    ///
+    /// \name Bounded summaries
+    ///
+    /// Reducers whose state has a fixed maximum size no matter how
+    /// many values they see. Neither can be unmerged.
+    ///
+    /// \{
+    // ---------------------------------------------------------------------- //
+    ///
+    /// The <code>K</code> values with the highest scores, highest
+    /// first, kept in a min-heap of at most <code>K</code> values so
+    /// that a value that does not make the cut costs one comparison.
+    /// Which of several values with equal scores is kept is
+    /// unspecified.
+    ///
+    template<std::size_t K, typename T, typename ScoreFn>
+    class topk_t {
+      typedef typename std::decay<typename std::result_of<const ScoreFn&(const T&)>::type>::type score_type;
+      typedef std::pair<score_type, T> entry_type;
+    public:
+      typedef std::vector<entry_type> state_type;
+      inline topk_t(ScoreFn score_fn) : score_fn_m(std::move(score_fn)) {}
+      inline state_type init() const {
+        state_type s;
+        s.reserve(K);
+        return s;
+      }
+      inline void accumulate(state_type& s, const T& x) const {
+        offer(s, score_fn_m(x), x);
+      }
+      inline void merge(state_type& s, const state_type& o) const {
+        for (const entry_type& e : o) {
+          offer(s, e.first, e.second);
+        }
+      }
+      inline std::vector<T> result(const state_type& s) const {
+        state_type sorted(s);
+        std::sort_heap(sorted.begin(), sorted.end(), &lower);
+        std::vector<T> result;
+        result.reserve(sorted.size());
+        for (entry_type& e : sorted) {
+          result.push_back(std::move(e.second));
+        }
+        return result;
+      }
+    private:
+      ScoreFn score_fn_m;
+      // Orders the heap so that the lowest score is on top.
+      static inline bool lower(const entry_type& a, const entry_type& b) {
+        return b.first < a.first;
+      }
+      inline void offer(state_type& s, const score_type& score, const T& x) const {
+        if (s.size() < K) {
+          s.emplace_back(score, x);
+          std::push_heap(s.begin(), s.end(), &lower);
+        } else if (K != 0 && s.front().first < score) {
+          std::pop_heap(s.begin(), s.end(), &lower);
+          s.back().first = score;
+          s.back().second = x;
+          std::push_heap(s.begin(), s.end(), &lower);
+        }
+      }
+    }; // topk_t
+    ///
+    /// The most frequent values, estimated with the Space-Saving
+    /// algorithm in at most <code>capacity</code> counters.
+    ///
+    /// A value that has no counter takes over the smallest one, and
+    /// inherits its count as possible error, so every count is an
+    /// upper bound that overestimates by at most
+    /// <code>n / capacity</code> after <code>n</code> values, and
+    /// every value that occurs more often than that has a counter.
+    /// The counters are a min-heap indexed by a hash map, so each
+    /// value costs O(log capacity). Summaries are merged by adding
+    /// counts (using the smallest count of a full summary for values
+    /// it does not have) and keeping the largest.
+    ///
+    template<typename T>
+    class heavy_hitters_t {
+    public:
+      struct counter_t {
+        T value;
+        std::size_t count;
+        std::size_t error;
+      };
+      struct state_type {
+        std::vector<counter_t> heap;
+        std::unordered_map<T, std::size_t> position;
+      };
+      inline explicit heavy_hitters_t(std::size_t capacity) : capacity_m(std::max<std::size_t>(capacity, 1)) {}
+      inline state_type init() const { return state_type(); }
+      inline void accumulate(state_type& s, const T& x) const {
+        typename std::unordered_map<T, std::size_t>::iterator it = s.position.find(x);
+        if (it != s.position.end()) {
+          ++s.heap[it->second].count;
+          sift_down(s, it->second);
+        } else if (s.heap.size() < capacity_m) {
+          s.position.emplace(x, s.heap.size());
+          s.heap.push_back(counter_t{ x, 1, 0 });
+          sift_up(s, s.heap.size() - 1);
+        } else {
+          counter_t& smallest = s.heap.front();
+          s.position.erase(smallest.value);
+          s.position.emplace(x, 0);
+          smallest.error = smallest.count;
+          ++smallest.count;
+          smallest.value = x;
+          sift_down(s, 0);
+        }
+      }
+      inline void merge(state_type& s, const state_type& o) const {
+        const std::size_t s_floor = s.heap.size() < capacity_m ? 0 : s.heap.front().count;
+        const std::size_t o_floor = o.heap.size() < capacity_m ? 0 : o.heap.front().count;
+        std::vector<counter_t> merged;
+        merged.reserve(s.heap.size() + o.heap.size());
+        for (const counter_t& c : s.heap) {
+          typename std::unordered_map<T, std::size_t>::const_iterator it = o.position.find(c.value);
+          if (it == o.position.end()) {
+            merged.push_back(counter_t{ c.value, c.count + o_floor, c.error + o_floor });
+          } else {
+            const counter_t& d = o.heap[it->second];
+            merged.push_back(counter_t{ c.value, c.count + d.count, c.error + d.error });
+          }
+        }
+        for (const counter_t& d : o.heap) {
+          if (s.position.find(d.value) == s.position.end()) {
+            merged.push_back(counter_t{ d.value, d.count + s_floor, d.error + s_floor });
+          }
+        }
+        if (merged.size() > capacity_m) {
+          std::nth_element(merged.begin(), merged.begin() + capacity_m, merged.end(), &more);
+          merged.resize(capacity_m);
+        }
+        s.heap.swap(merged);
+        s.position.clear();
+        for (std::size_t i = 0; i < s.heap.size(); ++i) {
+          s.position.emplace(s.heap[i].value, i);
+        }
+        for (std::size_t i = s.heap.size() / 2; i-- > 0;) {
+          sift_down(s, i);
+        }
+      }
+      ///
+      /// The values and their (overestimated) counts, most frequent
+      /// first.
+      ///
+      inline std::vector<std::pair<T, std::size_t> > result(const state_type& s) const {
+        std::vector<counter_t> sorted(s.heap);
+        std::sort(sorted.begin(), sorted.end(), &more);
+        std::vector<std::pair<T, std::size_t> > result;
+        result.reserve(sorted.size());
+        for (const counter_t& c : sorted) {
+          result.emplace_back(c.value, c.count);
+        }
+        return result;
+      }
+    private:
+      std::size_t capacity_m;
+      static inline bool more(const counter_t& a, const counter_t& b) {
+        return b.count < a.count;
+      }
+      static inline void swap_counters(state_type& s, std::size_t i, std::size_t j) {
+        std::swap(s.heap[i], s.heap[j]);
+        s.position[s.heap[i].value] = i;
+        s.position[s.heap[j].value] = j;
+      }
+      static inline void sift_up(state_type& s, std::size_t i) {
+        while (i != 0 && s.heap[i].count < s.heap[(i - 1) / 2].count) {
+          swap_counters(s, i, (i - 1) / 2);
+          i = (i - 1) / 2;
+        }
+      }
+      static inline void sift_down(state_type& s, std::size_t i) {
+        for (;;) {
+          std::size_t smallest = i;
+          for (std::size_t child = 2 * i + 1; child <= 2 * i + 2 && child < s.heap.size(); ++child) {
+            if (s.heap[child].count < s.heap[smallest].count) {
+              smallest = child;
+            }
+          }
+          if (smallest == i) {
+            return;
+          }
+          swap_counters(s, i, smallest);
+          i = smallest;
+        }
+      }
+    }; // heavy_hitters_t
+    ///
+    /// Advances a SplitMix64 generator and returns the next random
+    /// word; small enough to keep one per reducer state.
+    ///
+    inline std::uint64_t split_mix(std::uint64_t& x) {
+      std::uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    }
+    ///
+    /// A random number in (0, 1].
+    ///
+    inline double unit_random(std::uint64_t& x) {
+      return double((split_mix(x) >> 11) + 1) * (1.0 / 9007199254740992.0);
+    }
+    ///
+    /// The number of failures before the first success in trials
+    /// that succeed with probability <code>p</code>, i.e. how many
+    /// elements to skip before the next one is sampled.
+    ///
+    inline std::uint64_t geometric_skip(std::uint64_t& x, double p) {
+      if (p >= 1) {
+        return 0;
+      }
+      const double skip = p <= 0 ? std::numeric_limits<double>::infinity() : std::floor(std::log(unit_random(x)) / std::log1p(-p));
+      return skip < 1.8e19 ? std::uint64_t(skip) : std::numeric_limits<std::uint64_t>::max();
+    }
+    ///
+    /// A uniform sample of <code>K</code> values (or all of them, if
+    /// there are fewer), kept with Algorithm L: once the reservoir is
+    /// full, the number of values to skip before the next one goes in
+    /// is drawn directly, so a skipped value costs one comparison.
+    /// Two samples merge into a uniform sample of both streams by
+    /// drawing from each in proportion to what it has seen.
+    ///
+    /// Random numbers are drawn from the seed and the stream number of
+    /// the state, so a sample is the same every time it is taken from
+    /// the same values with the same seed (and, when reduced in
+    /// parallel, the same grain and number of threads). States from
+    /// <code>init()</code> all draw the same numbers, so separate
+    /// states that will be merged should come from
+    /// <code>init(stream)</code> with different streams.
+    ///
+    template<std::size_t K, typename T>
+    class reservoir_t {
+    public:
+      struct state_type {
+        std::vector<T> items;
+        std::uint64_t seen;
+        std::uint64_t next;
+        double w;
+        std::uint64_t random;
+      };
+      inline explicit reservoir_t(std::uint64_t seed) : seed_m(seed) {}
+      inline state_type init() const { return init(0); }
+      inline state_type init(std::uint64_t stream) const {
+        std::uint64_t random = stream;
+        return state_type{ {}, 0, 0, 0, seed_m ^ split_mix(random) };
+      }
+      inline void accumulate(state_type& s, const T& x) const {
+        if (K == 0) {
+          return;
+        }
+        ++s.seen;
+        if (s.items.size() < K) {
+          s.items.push_back(x);
+          if (s.items.size() == K) {
+            s.w = std::exp(std::log(unit_random(s.random)) / double(K));
+            skip(s);
+          }
+        } else if (s.seen == s.next) {
+          s.items[split_mix(s.random) % K] = x;
+          s.w *= std::exp(std::log(unit_random(s.random)) / double(K));
+          skip(s);
+        }
+      }
+      inline void merge(state_type& s, const state_type& o) const {
+        if (o.seen == 0) {
+          return;
+        }
+        if (s.seen == 0) {
+          s = o;
+          return;
+        }
+        std::vector<T> a(std::move(s.items));
+        std::vector<T> b(o.items);
+        std::uint64_t na = s.seen;
+        std::uint64_t nb = o.seen;
+        s.items.clear();
+        while (s.items.size() < K && (! a.empty() || ! b.empty())) {
+          const bool from_a = b.empty() || (! a.empty() && split_mix(s.random) % (na + nb) < na);
+          std::vector<T>& from = from_a ? a : b;
+          --(from_a ? na : nb);
+          const std::size_t i = std::size_t(split_mix(s.random) % from.size());
+          s.items.push_back(std::move(from[i]));
+          from[i] = std::move(from.back());
+          from.pop_back();
+        }
+        s.seen += o.seen;
+        if (s.items.size() == K) {
+          // The largest of the K smallest of n uniform priorities
+          // follows Beta(K, n - K + 1).
+          std::mt19937_64 engine(split_mix(s.random));
+          const double x = std::gamma_distribution<double>(double(K))(engine);
+          const double y = std::gamma_distribution<double>(double(s.seen - K + 1))(engine);
+          s.w = x / (x + y);
+          skip(s);
+        }
+      }
+      inline std::vector<T> result(const state_type& s) const { return s.items; }
+    private:
+      std::uint64_t seed_m;
+      static inline void skip(state_type& s) {
+        const std::uint64_t gap = geometric_skip(s.random, s.w);
+        s.next = gap < std::numeric_limits<std::uint64_t>::max() - s.seen ? s.seen + gap + 1 : std::numeric_limits<std::uint64_t>::max();
+      }
+    }; // reservoir_t
+    // ---------------------------------------------------------------------- //
+    /// \}
+
+
+    ///
+    /// Samples every element of a stream with probability
+    /// <code>rate</code>, by drawing the gap to the next sampled
+    /// element from a geometric distribution instead of drawing for
+    /// every element, so that elements that are not sampled cost
+    /// (next to) nothing. The gap carries over from one call to the
+    /// next, so a stream may come in pieces.
+    ///
+    class sample_t {
+    public:
+      inline sample_t(double rate, std::uint64_t seed)
+        : rate_m(rate)
+        , random_m(seed)
+        , skip_m(geometric_skip(random_m, rate_m))
+      {}
+      ///
+      /// The sampled elements of a range, in order. A random access
+      /// range is only read at the sampled elements.
+      ///
+      template<typename Range>
+      inline std::vector<typename range_value<Range>::type> operator()(const Range& range) {
+        std::vector<typename range_value<Range>::type> result;
+        apply(result, range, is_random_access_range<Range>());
+        return result;
+      }
+      ///
+      /// Whether the next element of a stream that comes one at a
+      /// time is sampled.
+      ///
+      inline bool next() {
+        if (skip_m == 0) {
+          skip_m = geometric_skip(random_m, rate_m);
+          return true;
+        }
+        --skip_m;
+        return false;
+      }
+    private:
+      double rate_m;
+      std::uint64_t random_m;
+      std::uint64_t skip_m;
+      template<typename Range, typename Results>
+      inline void apply(Results& result, const Range& range, std::true_type) {
+        const auto first = std::begin(range);
+        const std::uint64_t n = std::distance(first, std::end(range));
+        std::uint64_t i = 0;
+        while (skip_m < n - i) {
+          i += skip_m;
+          result.push_back(first[i]);
+          ++i;
+          skip_m = geometric_skip(random_m, rate_m);
+        }
+        skip_m -= n - i;
+      }
+      template<typename Range, typename Results>
+      inline void apply(Results& result, const Range& range, std::false_type) {
+        for (const auto& x : range) {
+          if (next()) {
+            result.push_back(x);
+          }
+        }
+      }
+    }; // sample_t
+
+
+    ///
+    /// Hints that the memory at <code>p</code> will be read soon.
+    ///
+    inline void prefetch(const void* p) {
+#if defined(__GNUC__)
+      __builtin_prefetch(p);
+#else
+      (void)p;
+#endif
+    }
+    ///
+    /// Meta function that determines whether a function has a
+    /// <code>prefetch</code> hook for arguments of type <code>T</code>.
+    ///
+    template<typename Func, typename T, typename = void>
+    struct has_prefetch : public std::false_type {};
+    template<typename Func, typename T>
+    struct has_prefetch<Func, T, decltype(std::declval<const Func&>().prefetch(std::declval<const T&>()))>
+      : public std::true_type
+    {};
+    ///
+    /// Applies a function to every element of a range.
+    ///
+    /// If the function has a <code>prefetch(x)</code> member (taking
+    /// the same argument as the call), it is called on the element
+    /// <code>k</code> places ahead of the one being processed, so that
+    /// whatever the function is going to look up for it is on its way
+    /// into cache. The lookahead <code>k</code> is tuned on the first
+    /// range that is long enough, by running one block of elements to
+    /// warm up and then timing a block at each power of two from 1 to
+    /// 64, keeping the fastest for this and every later call. Until
+    /// then, a fixed lookahead is used. Any other range is read a
+    /// block at a time into a buffer first, and prefetched from there.
+    ///
+    template<typename Func>
+    class each_t {
+      static const std::size_t block = 256;
+      static const std::size_t max_lookahead = 64;
+      static const std::size_t default_lookahead = 8;
+      // Lookaheads 1, 2, 4, ..., 64.
+      static const std::size_t tries = 7;
+    public:
+      inline each_t(Func&& func) : func_m(std::forward<Func>(func)), lookahead_m(0) {}
+      inline each_t(const each_t& o) : func_m(o.func_m), lookahead_m(o.lookahead()) {}
+      inline each_t(each_t&& o) : func_m(std::forward<Func>(o.func_m)), lookahead_m(o.lookahead()) {}
+      ///
+      /// The tuned lookahead, or zero if it has not been tuned yet.
+      ///
+      inline std::size_t lookahead() const { return lookahead_m.load(std::memory_order_relaxed); }
+      template<typename Range>
+      inline std::vector<typename std::decay<typename std::result_of<const Func&(const typename range_value<Range>::type&)>::type>::type>
+      operator()(const Range& range) const {
+        std::vector<typename std::decay<typename std::result_of<const Func&(const typename range_value<Range>::type&)>::type>::type> result;
+        apply(range, result, has_prefetch<typename std::decay<Func>::type, typename range_value<Range>::type>());
+        return result;
+      }
+    private:
+      Func func_m;
+      mutable std::atomic<std::size_t> lookahead_m;
+      template<typename Range, typename Results>
+      inline void apply(const Range& range, Results& result, std::false_type) const {
+        for (const auto& x : range) {
+          result.push_back(func_m(x));
+        }
+      }
+      template<typename Range, typename Results>
+      inline void apply(const Range& range, Results& result, std::true_type) const {
+        prefetch_each(range, result, is_random_access_range<Range>());
+      }
+      // Lookahead stops at the end of each block.
+      template<typename Range, typename Results>
+      inline void prefetch_each(const Range& range, Results& result, std::false_type) const {
+        for_each_block(range, 64 * block, [&](const std::vector<typename range_value<Range>::type>& elements) {
+            prefetch_each(elements, result, std::true_type());
+          });
+      }
+      template<typename Range, typename Results>
+      inline void prefetch_each(const Range& range, Results& result, std::true_type) const {
+        typedef std::chrono::steady_clock clock_type;
+        const auto first = std::begin(range);
+        const std::size_t n = std::distance(first, std::end(range));
+        result.reserve(result.size() + n);
+        std::size_t i = 0;
+        const auto run = [&](std::size_t end, std::size_t k) {
+          for (; i < end; ++i) {
+            if (i + k < n) {
+              func_m.prefetch(first[i + k]);
+            }
+            result.push_back(func_m(first[i]));
+          }
+        };
+        std::size_t lookahead = this->lookahead();
+        if (lookahead == 0 && n >= 2 * (tries + 1) * block) {
+          // The first block pays for cold caches and branch predictors
+          // whatever the lookahead, so it is left out of the timing.
+          run(block, default_lookahead);
+          clock_type::duration best = clock_type::duration::max();
+          for (std::size_t k = 1; k <= max_lookahead; k *= 2) {
+            const clock_type::time_point start = clock_type::now();
+            run(i + block, k);
+            const clock_type::duration took = clock_type::now() - start;
+            if (took < best) {
+              best = took;
+              lookahead = k;
+            }
+          }
+          lookahead_m.store(lookahead, std::memory_order_relaxed);
+        }
+        run(n, lookahead == 0 ? default_lookahead : lookahead);
+      }
+    }; // each_t
+    ///
+    /// Runs a stage written as a state machine over a group of
+    /// elements at a time, round robin, so that the memory accesses
+    /// of different elements overlap (asynchronous memory access
+    /// chaining).
+    ///
+    /// A state machine stage provides:
+    ///
+    /// - <code>state_type</code>, default constructible,
+    /// - <code>const void* start(state_type& s, const T& x) const</code>,
+    ///   which sets up the state for processing <code>x</code>,
+    /// - <code>const void* step(state_type& s) const</code>, which
+    ///   takes one step, and
+    /// - <code>result(const state_type& s) const</code>.
+    ///
+    /// Both <code>start</code> and <code>step</code> return the
+    /// address the next step is going to read, or null when the
+    /// element is done. The executor prefetches that address and
+    /// moves on to the next element in the group, so by the time it
+    /// comes back, the memory is (hopefully) in cache. As soon as an
+    /// element is done, its slot in the group is refilled with the
+    /// next element.
+    ///
+    template<typename Stage>
+    class interleave_t {
+      typedef typename std::decay<Stage>::type stage_type;
+      typedef typename stage_type::state_type state_type;
+      typedef typename std::decay<decltype(std::declval<const stage_type&>().result(std::declval<const state_type&>()))>::type result_type;
+    public:
+      inline interleave_t(Stage&& stage, std::size_t group)
+        : stage_m(std::forward<Stage>(stage))
+        , group_m(std::max<std::size_t>(group, 1))
+      {}
+      ///
+      /// Runs the stage over every element of the range, and returns
+      /// the results in the order of the range.
+      ///
+      template<typename Range>
+      inline std::vector<result_type> operator()(const Range& range) const {
+        std::vector<result_type> result;
+        apply(result, range, is_random_access_range<Range>());
+        return result;
+      }
+    private:
+      Stage stage_m;
+      std::size_t group_m;
+      template<typename Range>
+      inline void apply(std::vector<result_type>& result, const Range& range, std::true_type) const {
+        const auto first = std::begin(range);
+        run(result, first, std::distance(first, std::end(range)));
+      }
+      template<typename Range>
+      inline void apply(std::vector<result_type>& result, const Range& range, std::false_type) const {
+        for_each_block(range, serial_block, [&](const std::vector<typename range_value<Range>::type>& block) {
+            std::vector<result_type> part;
+            run(part, block.begin(), block.size());
+            result.insert(result.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+          });
+      }
+      ///
+      /// Steps the <code>n</code> elements from <code>first</code>
+      /// into <code>result</code>, which is resized to hold them.
+      ///
+      template<typename It>
+      inline void run(std::vector<result_type>& result, It first, std::size_t n) const {
+        result.resize(n);
+        std::vector<state_type> states(std::min(group_m, n));
+        std::vector<std::size_t> element(states.size());
+        std::size_t next = 0;
+        std::size_t active = 0;
+        for (std::size_t j = 0; j < states.size(); ++j) {
+          if (start(states[j], element[j], next, first, n, result)) {
+            ++active;
+          }
+        }
+        while (active != 0) {
+          for (std::size_t j = 0; j < states.size(); ++j) {
+            if (element[j] == n) {
+              continue;
+            }
+            const void* address = stage_m.step(states[j]);
+            if (address != nullptr) {
+              prefetch(address);
+            } else {
+              result[element[j]] = stage_m.result(states[j]);
+              if (! start(states[j], element[j], next, first, n, result)) {
+                --active;
+              }
+            }
+          }
+        }
+      }
+      ///
+      /// Fills a slot with the next element that needs stepping,
+      /// finishing elements that are done right away. Returns false
+      /// (leaving the slot at <code>n</code>) when there are no more
+      /// elements.
+      ///
+      template<typename It, typename Results>
+      inline bool start(state_type& state, std::size_t& element, std::size_t& next, It first, std::size_t n, Results& result) const {
+        while (next < n) {
+          element = next++;
+          const void* address = stage_m.start(state, first[element]);
+          if (address != nullptr) {
+            prefetch(address);
+            return true;
+          }
+          result[element] = stage_m.result(state);
+        }
+        element = n;
+        return false;
+      }
+    }; // interleave_t
+
+
+    ///
+    /// \name Hash tables
+    ///
+    /// \{
+    // ---------------------------------------------------------------------- //
+    ///
+    /// Hashes a key with <code>std::hash</code>, and mixes the bits
+    /// (many standard hashes of integers are the identity) so that
+    /// both the low bits (used to find a slot) and the high bits (used
+    /// to partition) are spread out.
+    ///
+    template<typename Key>
+    inline std::uint64_t mixed_hash(const Key& key) {
+      std::uint64_t h = static_cast<std::uint64_t>(std::hash<Key>()(key));
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ULL;
+      h ^= h >> 33;
+      return h;
+    }
+    ///
+    /// An open addressing hash map that keeps its entries densely in
+    /// insertion order, and a separate table of slots for looking them
+    /// up.
+    ///
+    /// A slot is a single 64 bit word holding the upper half of the
+    /// hash of the key and the position of the entry, so probing
+    /// (linearly, at most half full) compares hashes within a cache
+    /// line and only touches an entry when the hashes agree. The full
+    /// hash of each entry is kept as well, so that entries can be
+    /// moved to another map (or partition) without hashing again.
+    ///
+    template<typename Key, typename Value>
+    class flat_map_t {
+    public:
+      typedef std::pair<Key, Value> entry_type;
+      inline flat_map_t() : mask_m(0) {}
+      inline std::size_t size() const { return entries_m.size(); }
+      inline entry_type& entry(std::size_t i) { return entries_m[i]; }
+      inline const entry_type& entry(std::size_t i) const { return entries_m[i]; }
+      inline std::uint64_t hash(std::size_t i) const { return hashes_m[i]; }
+      inline std::vector<entry_type>& entries() { return entries_m; }
+      ///
+      /// The slot to look for a key with the given hash in first;
+      /// useful for prefetching.
+      ///
+      inline const std::uint64_t* slot_for(std::uint64_t hash) const {
+        return slots_m.empty() ? nullptr : &slots_m[hash & mask_m];
+      }
+      ///
+      /// Finds the position of the entry for <code>key</code>, or
+      /// <code>size()</code> if there is none.
+      ///
+      inline std::size_t find(const Key& key, std::uint64_t hash) const {
+        if (slots_m.empty()) {
+          return size();
+        }
+        const std::uint64_t tag = hash & ~std::uint64_t(0xffffffff);
+        for (std::size_t i = hash & mask_m; slots_m[i] != 0; i = (i + 1) & mask_m) {
+          const std::uint64_t slot = slots_m[i];
+          if ((slot & ~std::uint64_t(0xffffffff)) == tag && entries_m[(slot & 0xffffffff) - 1].first == key) {
+            return (slot & 0xffffffff) - 1;
+          }
+        }
+        return size();
+      }
+      ///
+      /// Finds the entry for <code>key</code>, or adds one with the
+      /// value <code>make_value()</code> if there is none.
+      ///
+      template<typename MakeValue>
+      inline Value& find_or_insert(const Key& key, std::uint64_t hash, const MakeValue& make_value) {
+        std::size_t i = find(key, hash);
+        if (i == size()) {
+          if (2 * (size() + 1) > slots_m.size()) {
+            rehash(std::max<std::size_t>(16, 2 * slots_m.size()));
+          }
+          entries_m.push_back(entry_type(key, make_value()));
+          hashes_m.push_back(hash);
+          place(hash, i);
+        }
+        return entries_m[i].second;
+      }
+      ///
+      /// Makes room for <code>n</code> entries without rehashing.
+      ///
+      inline void reserve(std::size_t n) {
+        std::size_t capacity = 16;
+        while (capacity < 2 * n) {
+          capacity *= 2;
+        }
+        if (capacity > slots_m.size()) {
+          rehash(capacity);
+        }
+        entries_m.reserve(n);
+        hashes_m.reserve(n);
+      }
+    private:
+      std::vector<entry_type> entries_m;
+      std::vector<std::uint64_t> hashes_m;
+      std::vector<std::uint64_t> slots_m;
+      std::size_t mask_m;
+      inline void place(std::uint64_t hash, std::size_t entry) {
+        std::size_t i = hash & mask_m;
+        while (slots_m[i] != 0) {
+          i = (i + 1) & mask_m;
+        }
+        slots_m[i] = (hash & ~std::uint64_t(0xffffffff)) | std::uint64_t(entry + 1);
+      }
+      inline void rehash(std::size_t capacity) {
+        slots_m.assign(capacity, 0);
+        mask_m = capacity - 1;
+        for (std::size_t i = 0; i < hashes_m.size(); ++i) {
+          place(hashes_m[i], i);
+        }
+      }
+    }; // flat_map_t
+    // ---------------------------------------------------------------------- //
+    /// \}
+
+
+    ///
+    /// \name Sketches
+    ///
+    /// Reducers that estimate an aggregate from a small summary of the
+    /// values, and whose summaries merge (exactly, for a given set of
+    /// values) so that they work per thread and inside batteries.
+    ///
+    /// \{
+    // ---------------------------------------------------------------------- //
+    ///
+    /// The number of leading zero bits of a nonzero value.
+    ///
+    inline int leading_zeros(std::uint64_t x) {
+#if defined(__GNUC__)
+      return __builtin_clzll(x);
+#else
+      int n = 0;
+      for (std::uint64_t bit = std::uint64_t(1) << 63; (x & bit) == 0; bit >>= 1) {
+        ++n;
+      }
+      return n;
+#endif
+    }
+    ///
+    /// The number of distinct values, estimated with HyperLogLog in
+    /// <code>2^precision</code> one byte registers, with a relative
+    /// standard error of about <code>1.04 / sqrt(2^precision)</code>.
+    /// Small counts fall back to linear counting.
+    ///
+    template<typename T>
+    class distinct_count_t {
+    public:
+      typedef std::vector<std::uint8_t> state_type;
+      inline explicit distinct_count_t(int precision)
+        : precision_m(std::min(std::max(precision, 4), 18))
+      {}
+      inline state_type init() const { return state_type(std::size_t(1) << precision_m, 0); }
+      inline void accumulate(state_type& s, const T& x) const {
+        const std::uint64_t hash = mixed_hash(x);
+        const std::uint8_t rank = std::uint8_t(leading_zeros((hash << precision_m) | (std::uint64_t(1) << (precision_m - 1))) + 1);
+        std::uint8_t& reg = s[hash >> (64 - precision_m)];
+        if (reg < rank) {
+          reg = rank;
+        }
+      }
+      inline void merge(state_type& s, const state_type& o) const {
+        for (std::size_t i = 0; i < s.size(); ++i) {
+          s[i] = std::max(s[i], o[i]);
+        }
+      }
+      inline double result(const state_type& s) const {
+        const double m = double(s.size());
+        double sum = 0;
+        std::size_t zeros = 0;
+        for (std::uint8_t reg : s) {
+          sum += std::ldexp(1.0, -int(reg));
+          zeros += reg == 0;
+        }
+        const double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+        if (estimate <= 2.5 * m && zeros != 0) {
+          return m * std::log(m / double(zeros));
+        }
+        return estimate;
+      }
+    private:
+      int precision_m;
+    }; // distinct_count_t
+    ///
+    /// Quantiles, estimated with a merging t-digest: values are kept
+    /// as weighted centroids, and neighbouring centroids are merged as
+    /// long as their weight stays below a bound that shrinks towards
+    /// the tails, so extreme quantiles are more accurate than the
+    /// median. The number of centroids is about
+    /// <code>compression</code>. New values are buffered and merged
+    /// into the centroids in sorted batches.
+    ///
+    template<typename T>
+    class quantiles_t {
+    public:
+      struct centroid_t {
+        double mean;
+        double weight;
+      };
+      struct state_type {
+        std::vector<centroid_t> centroids;
+        std::vector<centroid_t> buffer;
+        double min;
+        double max;
+      };
+      inline quantiles_t(std::vector<double> qs, double compression)
+        : qs_m(std::move(qs))
+        , compression_m(std::max(compression, 10.0))
+      {}
+      inline state_type init() const {
+        return state_type{ {}, {}, std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity() };
+      }
+      inline void accumulate(state_type& s, const T& x) const {
+        const double v = double(x);
+        s.buffer.push_back(centroid_t{ v, 1 });
+        s.min = std::min(s.min, v);
+        s.max = std::max(s.max, v);
+        if (s.buffer.size() >= 5 * std::size_t(compression_m)) {
+          compress(s);
+        }
+      }
+      inline void merge(state_type& s, const state_type& o) const {
+        s.buffer.insert(s.buffer.end(), o.centroids.begin(), o.centroids.end());
+        s.buffer.insert(s.buffer.end(), o.buffer.begin(), o.buffer.end());
+        s.min = std::min(s.min, o.min);
+        s.max = std::max(s.max, o.max);
+        compress(s);
+      }
+      ///
+      /// The estimated quantiles, in the order they were asked for, or
+      /// NaN if there were no values.
+      ///
+      inline std::vector<double> result(const state_type& s) const {
+        state_type c(s);
+        compress(c);
+        std::vector<double> result;
+        result.reserve(qs_m.size());
+        for (double q : qs_m) {
+          result.push_back(quantile(c, q));
+        }
+        return result;
+      }
+    private:
+      std::vector<double> qs_m;
+      double compression_m;
+      inline void compress(state_type& s) const {
+        if (s.buffer.empty()) {
+          return;
+        }
+        s.buffer.insert(s.buffer.end(), s.centroids.begin(), s.centroids.end());
+        std::sort(s.buffer.begin(), s.buffer.end(), [](const centroid_t& a, const centroid_t& b) { return a.mean < b.mean; });
+        double total = 0;
+        for (const centroid_t& c : s.buffer) {
+          total += c.weight;
+        }
+        s.centroids.clear();
+        double before = 0;
+        centroid_t current = s.buffer.front();
+        for (std::size_t i = 1; i < s.buffer.size(); ++i) {
+          const centroid_t& next = s.buffer[i];
+          const double weight = current.weight + next.weight;
+          const double q = (before + weight / 2) / total;
+          if (weight <= 4 * total * q * (1 - q) / compression_m) {
+            current.mean += (next.mean - current.mean) * next.weight / weight;
+            current.weight = weight;
+          } else {
+            before += current.weight;
+            s.centroids.push_back(current);
+            current = next;
+          }
+        }
+        s.centroids.push_back(current);
+        s.buffer.clear();
+      }
+      static inline double quantile(const state_type& s, double q) {
+        if (s.centroids.empty()) {
+          return std::numeric_limits<double>::quiet_NaN();
+        }
+        double total = 0;
+        for (const centroid_t& c : s.centroids) {
+          total += c.weight;
+        }
+        const double target = std::min(std::max(q, 0.0), 1.0) * total;
+        // Each centroid stands for its weight spread around its mean,
+        // and values in between are interpolated from the neighbouring
+        // centers (or the extremes, at the ends).
+        double at = 0;
+        double prev_mean = s.min;
+        double prev_at = 0;
+        for (const centroid_t& c : s.centroids) {
+          const double center = at + c.weight / 2;
+          if (target < center) {
+            const double span = center - prev_at;
+            return span <= 0 ? c.mean : prev_mean + (c.mean - prev_mean) * (target - prev_at) / span;
+          }
+          prev_mean = c.mean;
+          prev_at = center;
+          at += c.weight;
+        }
+        const double span = total - prev_at;
+        return span <= 0 ? s.max : prev_mean + (s.max - prev_mean) * (target - prev_at) / span;
+      }
+    }; // quantiles_t
+    ///
+    /// A count-min sketch: <code>depth</code> rows of
+    /// <code>width</code> counters, where every value adds one to a
+    /// counter per row picked by its hash, so the smallest of its
+    /// counters overestimates its count by at most
+    /// <code>e / width</code> of the total with probability
+    /// <code>1 - exp(-depth)</code>.
+    ///
+    template<typename T>
+    class count_min_sketch_t {
+    public:
+      inline count_min_sketch_t(std::size_t width, std::size_t depth)
+        : width_m(std::max<std::size_t>(width, 1))
+        , depth_m(std::max<std::size_t>(depth, 1))
+        , total_m(0)
+        , counts_m(width_m * depth_m, 0)
+      {}
+      inline void add(const T& x, std::uint64_t n = 1) {
+        const std::uint64_t hash = mixed_hash(x);
+        for (std::size_t row = 0; row < depth_m; ++row) {
+          counts_m[row * width_m + column(hash, row)] += n;
+        }
+        total_m += n;
+      }
+      ///
+      /// Takes away <code>n</code> of the times <code>x</code> was
+      /// added.
+      ///
+      inline void remove(const T& x, std::uint64_t n = 1) {
+        const std::uint64_t hash = mixed_hash(x);
+        for (std::size_t row = 0; row < depth_m; ++row) {
+          counts_m[row * width_m + column(hash, row)] -= n;
+        }
+        total_m -= n;
+      }
+      ///
+      /// An upper bound on the number of times <code>x</code> has
+      /// been added (less any that have been taken away).
+      ///
+      inline std::uint64_t count(const T& x) const {
+        const std::uint64_t hash = mixed_hash(x);
+        std::uint64_t result = std::numeric_limits<std::uint64_t>::max();
+        for (std::size_t row = 0; row < depth_m; ++row) {
+          result = std::min(result, counts_m[row * width_m + column(hash, row)]);
+        }
+        return result;
+      }
+      inline std::uint64_t total() const { return total_m; }
+      inline void merge(const count_min_sketch_t& o) {
+        for (std::size_t i = 0; i < counts_m.size(); ++i) {
+          counts_m[i] += o.counts_m[i];
+        }
+        total_m += o.total_m;
+      }
+      inline void unmerge(const count_min_sketch_t& o) {
+        for (std::size_t i = 0; i < counts_m.size(); ++i) {
+          counts_m[i] -= o.counts_m[i];
+        }
+        total_m -= o.total_m;
+      }
+    private:
+      std::size_t width_m;
+      std::size_t depth_m;
+      std::uint64_t total_m;
+      std::vector<std::uint64_t> counts_m;
+      // Double hashing on the two halves of the hash.
+      inline std::size_t column(std::uint64_t hash, std::size_t row) const {
+        const std::uint64_t h = ((hash & 0xffffffffULL) + row * ((hash >> 32) | 1)) & 0xffffffffULL;
+        return std::size_t(h * width_m >> 32);
+      }
+    }; // count_min_sketch_t
+    ///
+    /// A count-min sketch of the values, which can be queried for the
+    /// (over)estimated count of any value. The result is the sketch
+    /// itself, by reference. Single values can be taken out of a
+    /// sketch again, so a sliding window keeps one sketch and the raw
+    /// values rather than a sketch per value.
+    ///
+    template<typename T>
+    class count_min_t {
+    public:
+      typedef count_min_sketch_t<T> state_type;
+      typedef T value_type;
+      inline count_min_t(std::size_t width, std::size_t depth) : width_m(width), depth_m(depth) {}
+      inline state_type init() const { return state_type(width_m, depth_m); }
+      inline void accumulate(state_type& s, const T& x) const { s.add(x); }
+      inline void unaccumulate(state_type& s, const T& x) const { s.remove(x); }
+      inline void merge(state_type& s, const state_type& o) const { s.merge(o); }
+      inline void unmerge(state_type& s, const state_type& o) const { s.unmerge(o); }
+      inline const state_type& result(const state_type& s) const { return s; }
+    private:
+      std::size_t width_m;
+      std::size_t depth_m;
+    }; // count_min_t
+    // ---------------------------------------------------------------------- //
+    /// \}
+
+
+    ///
+    /// Reduces a range in parallel: each thread accumulates its part
+    /// of the range into a state of its own, and the states are
+    /// merged in order at the end.
+    ///
+    template<typename Reducer>
+    class reduce_t {
+      typedef typename std::decay<Reducer>::type reducer_type;
+      typedef reducer_ops<reducer_type> ops;
+    public:
+      inline reduce_t(Reducer&& reducer, std::size_t grain)
+        : reducer_m(std::forward<Reducer>(reducer))
+        , grain_m(std::max<std::size_t>(grain, 1))
+      {}
+      template<typename Range>
+      inline typename ops::result_type operator()(const Range& range) const {
+        std::vector<typename ops::state_type> states;
+        apply(states, range, is_random_access_range<Range>());
+        return ops::result(reducer_m, states[0]);
+      }
+    private:
+      Reducer reducer_m;
+      std::size_t grain_m;
+      template<typename Range>
+      inline void apply(std::vector<typename ops::state_type>& states, const Range& range, std::true_type) const {
+        const auto first = std::begin(range);
+        reduce_block(states, first, std::distance(first, std::end(range)));
+      }
+      // Every block is merged into the state of the blocks before it,
+      // and every chunk of every block starts a stream of its own.
+      template<typename Range>
+      inline void apply(std::vector<typename ops::state_type>& states, const Range& range, std::false_type) const {
+        std::size_t streams = 0;
+        std::vector<typename ops::state_type> block_states;
+        for_each_block(range, block_for(grain_m), [&](const std::vector<typename range_value<Range>::type>& block) {
+            block_states.clear();
+            streams += reduce_block(block_states, block.begin(), block.size(), streams);
+            if (states.empty()) {
+              states.push_back(std::move(block_states[0]));
+            } else {
+              ops::merge(reducer_m, states[0], block_states[0]);
+            }
+          });
+        if (states.empty()) {
+          states.push_back(ops::init(reducer_m, 0));
+        }
+      }
+      ///
+      /// Reduces <code>n</code> elements in parallel into
+      /// <code>states[0]</code>, with chunk <code>c</code> seeded as
+      /// stream <code>stream + c</code>. Returns the number of chunks.
+      ///
+      template<typename It>
+      inline std::size_t reduce_block(std::vector<typename ops::state_type>& states, It first, std::size_t n, std::size_t stream = 0) const {
+        states.reserve(chunk_count(n, grain_m));
+        for (std::size_t c = 0; c < chunk_count(n, grain_m); ++c) {
+          states.push_back(ops::init(reducer_m, stream + c));
+        }
+        parallel_chunks(n, grain_m, [&](std::size_t c, std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+              ops::accumulate(reducer_m, states[c], first[i]);
+            }
+          });
+        for (std::size_t c = 1; c < states.size(); ++c) {
+          ops::merge(reducer_m, states[0], states[c]);
+        }
+        return states.size();
+      }
+    }; // reduce_t
+    ///
+    /// Groups the elements of a range by key and reduces each group.
+    ///
+    /// Each thread aggregates its part of the range into a hash map of
+    /// its own. When there are few groups, the maps are merged in
+    /// order on the calling thread. When there are many, each thread
+    /// also splits its groups into one partition per thread on the
+    /// high bits of their hashes, and then every thread merges one
+    /// partition from all the maps, so that merging is parallel too
+    /// and never contended.
+    ///
+    template<typename KeyFn, typename Reducer>
+    class group_by_t {
+      typedef typename std::decay<Reducer>::type reducer_type;
+      typedef reducer_ops<reducer_type> ops;
+      typedef typename ops::state_type state_type;
+    public:
+      inline group_by_t(KeyFn&& key_fn, Reducer&& reducer, std::size_t grain, std::size_t partition_above)
+        : key_fn_m(std::forward<KeyFn>(key_fn))
+        , reducer_m(std::forward<Reducer>(reducer))
+        , grain_m(std::max<std::size_t>(grain, 1))
+        , partition_above_m(partition_above)
+      {}
+      ///
+      /// Returns the key and aggregate of every group, in no
+      /// particular order.
+      ///
+      template<typename Range>
+      inline std::vector<std::pair<typename std::decay<typename std::result_of<const KeyFn&(const typename range_value<Range>::type&)>::type>::type, typename ops::result_type> >
+      operator()(const Range& range) const {
+        typedef typename std::decay<typename std::result_of<const KeyFn&(const typename range_value<Range>::type&)>::type>::type key_type;
+        typedef flat_map_t<key_type, state_type> map_type;
+        const auto make_state = [this]() { return ops::init(reducer_m); };
+        std::vector<map_type> maps;
+        gather(maps, range, is_random_access_range<Range>());
+        const std::size_t chunks = maps.size();
+        std::size_t groups = 0;
+        for (const map_type& map : maps) {
+          groups += map.size();
+        }
+        std::vector<map_type> parts;
+        if (chunks == 1 || groups <= partition_above_m) {
+          parts.resize(1);
+          merge_into(parts[0], maps, 0, 1, make_state);
+        } else {
+          parts.resize(chunks);
+          parallel_chunks(chunks, 1, [&](std::size_t, std::size_t begin, std::size_t end) {
+              for (std::size_t p = begin; p < end; ++p) {
+                merge_into(parts[p], maps, p, chunks, make_state);
+              }
+            });
+        }
+        std::vector<std::pair<key_type, typename ops::result_type> > result;
+        result.reserve(groups);
+        for (map_type& part : parts) {
+          for (typename map_type::entry_type& entry : part.entries()) {
+            result.push_back(std::make_pair(std::move(entry.first), ops::result(reducer_m, entry.second)));
+          }
+        }
+        return result;
+      }
+    private:
+      KeyFn key_fn_m;
+      Reducer reducer_m;
+      std::size_t grain_m;
+      std::size_t partition_above_m;
+      template<typename Map, typename Range>
+      inline void gather(std::vector<Map>& maps, const Range& range, std::true_type) const {
+        const auto first = std::begin(range);
+        build_maps(maps, first, std::distance(first, std::end(range)));
+      }
+      // The maps of every block are merged into a single map as soon
+      // as the block is done, so only the groups are kept, not the
+      // blocks.
+      template<typename Map, typename Range>
+      inline void gather(std::vector<Map>& maps, const Range& range, std::false_type) const {
+        const auto make_state = [this]() { return ops::init(reducer_m); };
+        std::size_t streams = 0;
+        std::vector<Map> block_maps;
+        maps.resize(1);
+        for_each_block(range, block_for(grain_m), [&](const std::vector<typename range_value<Range>::type>& block) {
+            block_maps.clear();
+            streams += build_maps(block_maps, block.begin(), block.size(), streams);
+            merge_into(maps[0], block_maps, 0, 1, make_state);
+          });
+      }
+      ///
+      /// Aggregates <code>n</code> elements into one map per chunk,
+      /// in parallel. Returns the number of chunks.
+      ///
+      template<typename Map, typename It>
+      inline std::size_t build_maps(std::vector<Map>& maps, It first, std::size_t n, std::size_t stream = 0) const {
+        typedef typename Map::entry_type::first_type key_type;
+        maps.resize(chunk_count(n, grain_m));
+        parallel_chunks(n, grain_m, [&](std::size_t c, std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+              const key_type key = key_fn_m(first[i]);
+              const std::uint64_t hash = mixed_hash(key);
+              // Every chunk of every group starts a stream of its own.
+              const std::uint64_t chunk = stream + c;
+              const auto make_chunk_state = [this, hash, chunk]() { return ops::init(reducer_m, hash + chunk * 0x9e3779b97f4a7c15ULL); };
+              ops::accumulate(reducer_m, maps[c].find_or_insert(key, hash, make_chunk_state), first[i]);
+            }
+          });
+        return maps.size();
+      }
+      ///
+      /// Merges the groups whose hash falls in partition
+      /// <code>p</code> of <code>parts</code> from all the maps, in
+      /// order.
+      ///
+      template<typename Map, typename MakeState>
+      inline void merge_into(Map& part, std::vector<Map>& maps, std::size_t p, std::size_t parts, const MakeState& make_state) const {
+        for (Map& map : maps) {
+          for (std::size_t i = 0; i < map.size(); ++i) {
+            const std::uint64_t hash = map.hash(i);
+            if (parts == 1 || (hash >> 32) * parts >> 32 == p) {
+              ops::merge(reducer_m, part.find_or_insert(map.entry(i).first, hash, make_state), map.entry(i).second);
+            }
+          }
+        }
+      }
+    }; // group_by_t
+    ///
+    /// Joins a range of probe rows against a table built from a range
+    /// of build rows, on equal keys.
+    ///
+    /// The build rows are copied in and indexed by a
+    /// <code>flat_map_t</code> from key to the first row with that
+    /// key, with rows sharing a key chained together. Probing goes in
+    /// groups of <code>group</code> rows: first every key in the group
+    /// is hashed and its slot prefetched, then the group is looked up,
+    /// so that the cache misses of a whole group overlap instead of
+    /// being paid one at a time.
+    ///
+    template<typename Build, typename BuildKey, typename ProbeKey>
+    class join_t {
+      typedef typename std::decay<typename std::result_of<const BuildKey&(const Build&)>::type>::type key_type;
+      static const std::size_t npos = std::size_t(-1);
+      static const std::size_t group = 16;
+    public:
+      template<typename Range>
+      inline join_t(const Range& build, BuildKey&& build_key, ProbeKey&& probe_key)
+        : rows_m(std::begin(build), std::end(build))
+        , next_m(rows_m.size(), npos)
+        , build_key_m(std::forward<BuildKey>(build_key))
+        , probe_key_m(std::forward<ProbeKey>(probe_key))
+      {
+        index_m.reserve(rows_m.size());
+        last_m.reserve(rows_m.size());
+        for (std::size_t i = 0; i < rows_m.size(); ++i) {
+          const key_type key = build_key_m(rows_m[i]);
+          const std::uint64_t hash = mixed_hash(key);
+          const std::size_t e = index_m.find(key, hash);
+          if (e == index_m.size()) {
+            index_m.find_or_insert(key, hash, [i]() { return i; });
+            last_m.push_back(i);
+          } else {
+            next_m[last_m[e]] = i;
+            last_m[e] = i;
+          }
+        }
+      }
+      ///
+      /// Returns a tuple of the build row and the probe row for every
+      /// match, in the order of the probe rows.
+      ///
+      template<typename Range>
+      inline std::vector<std::tuple<Build, typename range_value<Range>::type> >
+      operator()(const Range& probe) const {
+        std::vector<std::tuple<Build, typename range_value<Range>::type> > result;
+        apply(result, probe, is_random_access_range<Range>());
+        return result;
+      }
+    private:
+      std::vector<Build> rows_m;
+      std::vector<std::size_t> next_m;
+      std::vector<std::size_t> last_m;
+      flat_map_t<key_type, std::size_t> index_m;
+      BuildKey build_key_m;
+      ProbeKey probe_key_m;
+      template<typename Results, typename Range>
+      inline void apply(Results& result, const Range& probe, std::true_type) const {
+        const auto first = std::begin(probe);
+        probe_block(result, first, std::distance(first, std::end(probe)));
+      }
+      template<typename Results, typename Range>
+      inline void apply(Results& result, const Range& probe, std::false_type) const {
+        for_each_block(probe, serial_block, [&](const std::vector<typename range_value<Range>::type>& block) {
+            probe_block(result, block.begin(), block.size());
+          });
+      }
+      ///
+      /// Appends the matches of <code>n</code> probe rows to
+      /// <code>result</code>.
+      ///
+      template<typename Results, typename It>
+      inline void probe_block(Results& result, It first, std::size_t n) const {
+        key_type keys[group];
+        std::uint64_t hashes[group];
+        for (std::size_t g = 0; g < n; g += group) {
+          const std::size_t m = std::min(group, n - g);
+          for (std::size_t j = 0; j < m; ++j) {
+            keys[j] = probe_key_m(first[g + j]);
+            hashes[j] = mixed_hash(keys[j]);
+            prefetch(index_m.slot_for(hashes[j]));
+          }
+          for (std::size_t j = 0; j < m; ++j) {
+            const std::size_t e = index_m.find(keys[j], hashes[j]);
+            if (e != index_m.size()) {
+              for (std::size_t i = index_m.entry(e).second; i != npos; i = next_m[i]) {
+                result.push_back(std::make_tuple(rows_m[i], first[g + j]));
+              }
+            }
+          }
+        }
+      }
+    }; // join_t
+    template<typename Build, typename BuildKey, typename ProbeKey>
+    const std::size_t join_t<Build, BuildKey, ProbeKey>::npos;
+    template<typename Build, typename BuildKey, typename ProbeKey>
+    const std::size_t join_t<Build, BuildKey, ProbeKey>::group;
+    ///
+    /// The sorted elements of a range, read back one at a time from
+    /// sorted runs (in memory, or spilled to temporary files) through
+    /// a loser tree, so that producing the next element costs one
+    /// comparison per level of the tree.
+    ///
+    /// This is a single pass input range, which can be passed on to
+    /// the next stage of a pipe as is: the merge state is shared by
+    /// all copies of the range, and every call to <code>begin()</code>
+    /// picks up where the last iterator left off.
+    ///
+    template<typename T, typename KeyFn>
+    class merged_runs_t {
+      struct closer_t {
+        inline void operator()(std::FILE* file) const { std::fclose(file); }
+      };
+      struct run_t {
+        std::unique_ptr<std::FILE, closer_t> file;
+        std::vector<T> buffer;
+        std::size_t at;
+        std::size_t left;
+      };
+      struct state_t {
+        KeyFn key_fn;
+        std::size_t buffer;
+        std::vector<run_t> runs;
+        // Node 0 holds the winner, the others hold the losers of their
+        // games.
+        std::vector<std::size_t> tree;
+        bool started;
+        inline void start() {
+          if (started) {
+            return;
+          }
+          started = true;
+          std::size_t spilled = 0;
+          for (const run_t& run : runs) {
+            spilled += run.file != nullptr;
+          }
+          buffer = std::max<std::size_t>(buffer / std::max<std::size_t>(spilled, 1), 1);
+          for (run_t& run : runs) {
+            if (run.file != nullptr) {
+              std::rewind(run.file.get());
+            }
+            refill(run);
+          }
+          // Every node starts out holding the sentinel, which beats
+          // everything, and is replaced as the runs play their way up.
+          tree.assign(std::max<std::size_t>(runs.size(), 1), runs.size());
+          for (std::size_t i = runs.size(); i-- > 0;) {
+            replay(i);
+          }
+        }
+        inline bool empty() const { return runs.empty() || exhausted(tree[0]); }
+        inline bool exhausted(std::size_t r) const { return runs[r].at == runs[r].buffer.size(); }
+        inline const T& top() const { return runs[tree[0]].buffer[runs[tree[0]].at]; }
+        inline void pop() {
+          run_t& run = runs[tree[0]];
+          if (++run.at == run.buffer.size()) {
+            refill(run);
+          }
+          replay(tree[0]);
+        }
+        inline void refill(run_t& run) {
+          if (run.file == nullptr || run.left == 0) {
+            return;
+          }
+          run.buffer.resize(std::min(buffer, run.left));
+          if (std::fread(run.buffer.data(), sizeof(T), run.buffer.size(), run.file.get()) != run.buffer.size()) {
+            throw std::runtime_error("sort_by: cannot read back a spilled run");
+          }
+          run.left -= run.buffer.size();
+          run.at = 0;
+        }
+        // Whether run a loses to run b; ties go to the earlier run, so
+        // that the merge is stable.
+        inline bool loses(std::size_t a, std::size_t b) const {
+          if (a == runs.size() || b == runs.size()) {
+            return b == runs.size() && a != b;
+          }
+          if (exhausted(a) || exhausted(b)) {
+            return exhausted(a) && ! exhausted(b);
+          }
+          const auto& ka = key_fn(runs[a].buffer[runs[a].at]);
+          const auto& kb = key_fn(runs[b].buffer[runs[b].at]);
+          return kb < ka || (! (ka < kb) && b < a);
+        }
+        inline void replay(std::size_t r) {
+          for (std::size_t node = (r + runs.size()) / 2; node > 0; node /= 2) {
+            if (loses(r, tree[node])) {
+              std::swap(r, tree[node]);
+            }
+          }
+          tree[0] = r;
+        }
+      };
+    public:
+      class iterator {
+      public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+        inline iterator() : state_m(nullptr) {}
+        inline const T& operator*() const { return state_m->top(); }
+        inline const T* operator->() const { return &state_m->top(); }
+        inline iterator& operator++() {
+          state_m->pop();
+          return *this;
+        }
+        inline void operator++(int) { ++*this; }
+        inline bool operator==(const iterator& o) const { return done() == o.done(); }
+        inline bool operator!=(const iterator& o) const { return done() != o.done(); }
+      private:
+        friend class merged_runs_t;
+        state_t* state_m;
+        inline explicit iterator(state_t* state) : state_m(state) {}
+        inline bool done() const { return state_m == nullptr || state_m->empty(); }
+      };
+      typedef iterator const_iterator;
+      ///
+      /// Reads spilled runs back through buffers that hold
+      /// <code>buffer</code> elements between them.
+      ///
+      inline merged_runs_t(const KeyFn& key_fn, std::size_t buffer)
+        : state_m(new state_t{ key_fn, std::max<std::size_t>(buffer, 1), {}, {}, false })
+      {}
+      ///
+      /// Adds a sorted run kept in memory.
+      ///
+      inline void add(std::vector<T>&& run) {
+        if (! run.empty()) {
+          const std::size_t n = run.size();
+          state_m->runs.push_back(run_t{ nullptr, std::move(run), 0, n });
+        }
+      }
+      ///
+      /// Adds a sorted run of <code>n</code> elements that is written
+      /// to <code>file</code> before the range is first read.
+      ///
+      inline void add(std::FILE* file, std::size_t n) {
+        state_m->runs.push_back(run_t{ std::unique_ptr<std::FILE, closer_t>(file), std::vector<T>(), 0, n });
+      }
+      inline iterator begin() const {
+        state_m->start();
+        return iterator(state_m.get());
+      }
+      inline iterator end() const { return iterator(); }
+    private:
+      std::shared_ptr<state_t> state_m;
+    }; // merged_runs_t
+    ///
+    /// Sorts a range by key in external memory: the range is read
+    /// once, in runs of as many elements as fit in half the memory
+    /// budget, which are sorted (each in parallel chunks), and written
+    /// to temporary files in one sequential write each, on a thread of
+    /// its own while the next run is being read and sorted. The runs
+    /// are merged back when the result is read. A range that fits in
+    /// the budget is sorted as a single run that never touches the
+    /// disk. Since the range is never indexed, it may be a single pass
+    /// input range that does not fit in memory. The sort is stable, and the
+    /// elements must be trivially copyable since they are written as
+    /// bytes.
+    ///
+    template<typename KeyFn>
+    class sort_by_t {
+      struct joiner_t {
+        std::thread thread;
+        inline ~joiner_t() {
+          if (thread.joinable()) {
+            thread.join();
+          }
+        }
+      };
+    public:
+      inline sort_by_t(KeyFn&& key_fn, std::size_t memory_budget, std::size_t grain)
+        : key_fn_m(std::forward<KeyFn>(key_fn))
+        , memory_budget_m(memory_budget)
+        , grain_m(std::max<std::size_t>(grain, 1))
+      {}
+      template<typename Range>
+      inline merged_runs_t<typename range_value<Range>::type, typename std::decay<KeyFn>::type>
+      operator()(const Range& range) const {
+        typedef typename range_value<Range>::type value_type;
+        static_assert(std::is_trivially_copyable<value_type>::value, "sort_by spills elements as bytes, so they must be trivially copyable");
+        const std::size_t budget = std::max<std::size_t>(memory_budget_m / sizeof(value_type), 2);
+        merged_runs_t<value_type, typename std::decay<KeyFn>::type> result(key_fn_m, budget);
+        auto it = std::begin(range);
+        const auto last = std::end(range);
+        // The buffer grows with the input, but never past the budget.
+        std::vector<value_type> held;
+        for (; it != last && held.size() < budget; ++it) {
+          if (held.size() == held.capacity()) {
+            held.reserve(std::min(budget, std::max<std::size_t>(2 * held.size(), 16)));
+          }
+          held.push_back(*it);
+        }
+        if (it == last) {
+          sort_run(held.begin(), held.size());
+          result.add(std::move(held));
+          return result;
+        }
+        // The buffer is split in two halves that take turns: one is
+        // read and sorted while the other is written.
+        const std::size_t begin[2] = { 0, budget / 2 };
+        const std::size_t size[2] = { budget / 2, budget - budget / 2 };
+        std::size_t count[2] = { size[0], size[1] };
+        bool written = true;
+        joiner_t writer;
+        for (std::size_t h = 0, round = 0; ; h ^= 1, ++round) {
+          if (round >= 2) {
+            for (count[h] = 0; it != last && count[h] < size[h]; ++it) {
+              held[begin[h] + count[h]++] = *it;
+            }
+          }
+          if (count[h] == 0) {
+            break;
+          }
+          sort_run(held.begin() + begin[h], count[h]);
+          std::FILE* file = std::tmpfile();
+          if (file == nullptr) {
+            throw std::runtime_error("sort_by: cannot create a temporary file");
+          }
+          result.add(file, count[h]);
+          if (writer.thread.joinable()) {
+            writer.thread.join();
+          }
+          if (! written) {
+            break;
+          }
+          const value_type* data = held.data() + begin[h];
+          const std::size_t n = count[h];
+          writer.thread = std::thread([&written, data, n, file]() {
+              written = std::fwrite(data, sizeof(value_type), n, file) == n && std::fflush(file) == 0;
+            });
+        }
+        if (writer.thread.joinable()) {
+          writer.thread.join();
+        }
+        if (! written) {
+          throw std::runtime_error("sort_by: cannot spill a run to a temporary file");
+        }
+        return result;
+      }
+    private:
+      KeyFn key_fn_m;
+      std::size_t memory_budget_m;
+      std::size_t grain_m;
+      ///
+      /// Sorts chunks in parallel, then merges pairs of neighbours
+      /// (also in parallel) until one is left.
+      ///
+      template<typename It>
+      inline void sort_run(It first, std::size_t n) const {
+        typedef typename std::iterator_traits<It>::value_type T;
+        const auto less = [this](const T& a, const T& b) { return key_fn_m(a) < key_fn_m(b); };
+        parallel_chunks(n, grain_m, [&](std::size_t, std::size_t begin, std::size_t end) {
+            std::stable_sort(first + begin, first + end, less);
+          });
+        for (std::size_t width = chunk_size(n, grain_m); width < n; width *= 2) {
+          parallel_chunks((n + 2 * width - 1) / (2 * width), 1, [&](std::size_t, std::size_t begin, std::size_t end) {
+              for (std::size_t pair = begin; pair < end; ++pair) {
+                const std::size_t middle = std::min(n, (2 * pair + 1) * width);
+                std::inplace_merge(first + 2 * pair * width, first + middle,
+                                   first + std::min(n, (2 * pair + 2) * width), less);
+              }
+            });
+        }
+      }
+    }; // sort_by_t
+
+
+    ///
+    /// \name Sliding windows
+    ///
+    /// A window has to be able to take values out again from the
+    /// front. How that is done depends on the reducer: one that can
+    /// unaccumulate keeps the raw values and a single state, and
+    /// otherwise the window keeps one state per value it covers (the
+    /// value accumulated into an empty state). Those states are cheap
+    /// for exact aggregates, but for the bounded summaries and
+    /// sketches other than count-min they are as large as the whole
+    /// summary, and every value copies and merges a few of them.
+    ///
+    /// \{
+    // ---------------------------------------------------------------------- //
+    ///
+    /// Declaration.
+    ///
+    template<typename Reducer,
+             bool Removable = reducer_ops<Reducer>::removable,
+             bool Invertible = reducer_ops<Reducer>::invertible>
+    class window_queue_t;
+    ///
+    /// Keeps a running aggregate, and the values in it, which are
+    /// unaccumulated as they leave the window.
+    ///
+    template<typename Reducer, bool Invertible>
+    class window_queue_t<Reducer, true, Invertible> {
+      typedef reducer_ops<Reducer> ops;
+    public:
+      typedef typename ops::state_type state_type;
+      inline window_queue_t(const Reducer& reducer)
+        : total_m(ops::init(reducer))
+      {}
+      inline std::size_t size() const { return items_m.size(); }
+      template<typename T>
+      inline void push(const Reducer& reducer, const T& x) {
+        items_m.push_back(x);
+        ops::accumulate(reducer, total_m, items_m.back());
+      }
+      inline void pop(const Reducer& reducer) {
+        ops::unaccumulate(reducer, total_m, items_m.front());
+        items_m.pop_front();
+      }
+      inline const state_type& total(const Reducer&) const { return total_m; }
+    private:
+      std::deque<typename ops::value_type> items_m;
+      state_type total_m;
+    }; // window_queue_t<Reducer, true, Invertible>
+    ///
+    /// Keeps a running aggregate, and unmerges values from it as they
+    /// leave the window.
+    ///
+    template<typename Reducer>
+    class window_queue_t<Reducer, false, true> {
+      typedef reducer_ops<Reducer> ops;
+    public:
+      typedef typename ops::state_type state_type;
+      inline window_queue_t(const Reducer& reducer)
+        : total_m(ops::init(reducer))
+      {}
+      inline std::size_t size() const { return items_m.size(); }
+      template<typename T>
+      inline void push(const Reducer& reducer, const T& x) {
+        items_m.push_back(ops::init(reducer));
+        ops::accumulate(reducer, items_m.back(), x);
+        ops::merge(reducer, total_m, items_m.back());
+      }
+      inline void pop(const Reducer& reducer) {
+        ops::unmerge(reducer, total_m, items_m.front());
+        items_m.pop_front();
+      }
+      inline const state_type& total(const Reducer&) const { return total_m; }
+    private:
+      std::deque<state_type> items_m;
+      state_type total_m;
+    }; // window_queue_t<Reducer, false, true>
+    ///
+    /// Keeps the window as two stacks: new values are pushed on the
+    /// back stack, which keeps a running aggregate, and old values are
+    /// popped from the front stack, where each entry holds the
+    /// aggregate of itself and all the newer entries in the front
+    /// stack. When the front stack runs out, the back stack is moved
+    /// over in one go. Every value is merged a constant number of
+    /// times, so each push and pop costs O(1) merges amortized, but
+    /// the total is a copy of the front aggregate merged with the back
+    /// one on every call.
+    ///
+    template<typename Reducer>
+    class window_queue_t<Reducer, false, false> {
+      typedef reducer_ops<Reducer> ops;
+    public:
+      typedef typename ops::state_type state_type;
+      inline window_queue_t(const Reducer& reducer)
+        : back_total_m(ops::init(reducer))
+        , total_m(back_total_m)
+      {}
+      inline std::size_t size() const { return front_m.size() + back_m.size(); }
+      template<typename T>
+      inline void push(const Reducer& reducer, const T& x) {
+        back_m.push_back(ops::init(reducer));
+        ops::accumulate(reducer, back_m.back(), x);
+        ops::merge(reducer, back_total_m, back_m.back());
+      }
+      inline void pop(const Reducer& reducer) {
+        if (front_m.empty()) {
+          for (std::size_t i = back_m.size(); i-- > 0; ) {
+            if (! front_m.empty()) {
+              ops::merge(reducer, back_m[i], front_m.back());
+            }
+            front_m.push_back(std::move(back_m[i]));
+          }
+          back_m.clear();
+          back_total_m = ops::init(reducer);
+        }
+        front_m.pop_back();
+      }
+      inline const state_type& total(const Reducer& reducer) const {
+        if (front_m.empty()) {
+          return back_total_m;
+        }
+        total_m = front_m.back();
+        ops::merge(reducer, total_m, back_total_m);
+        return total_m;
+      }
+    private:
+      std::vector<state_type> front_m;
+      std::vector<state_type> back_m;
+      state_type back_total_m;
+      mutable state_type total_m;
+    }; // window_queue_t<Reducer, false, false>
+    ///
+    /// Aggregates the last <code>N</code> values it was called with.
+    ///
+    template<std::size_t N, typename Reducer>
+    class window_t {
+      typedef typename std::decay<Reducer>::type reducer_type;
+      typedef reducer_ops<reducer_type> ops;
+    public:
+      inline window_t(Reducer&& reducer)
+        : reducer_m(std::forward<Reducer>(reducer))
+        , queue_m(reducer_m)
+      {}
+      template<typename T>
+      inline typename ops::view_type operator()(const T& x) {
+        queue_m.push(reducer_m, x);
+        if (queue_m.size() > N) {
+          queue_m.pop(reducer_m);
+        }
+        return ops::result(reducer_m, queue_m.total(reducer_m));
+      }
+    private:
+      Reducer reducer_m;
+      window_queue_t<reducer_type> queue_m;
+    }; // window_t
+    ///
+    /// Aggregates the values it was called with during the last
+    /// <code>span</code> of time.
+    ///
+    template<typename Reducer>
+    class timed_window_t {
+      typedef typename std::decay<Reducer>::type reducer_type;
+      typedef reducer_ops<reducer_type> ops;
+    public:
+      typedef std::chrono::steady_clock clock_type;
+      inline timed_window_t(clock_type::duration span, Reducer&& reducer)
+        : span_m(span)
+        , reducer_m(std::forward<Reducer>(reducer))
+        , queue_m(reducer_m)
+      {}
+      ///
+      /// Adds a value observed at time <code>t</code>, which should
+      /// not be earlier than any previous value, and drops values
+      /// older than <code>t - span</code>. With a span that is not
+      /// positive, that includes the value just added, so the result
+      /// is always that of no values.
+      ///
+      template<typename T>
+      inline typename ops::view_type operator()(clock_type::time_point t, const T& x) {
+        queue_m.push(reducer_m, x);
+        times_m.push_back(t);
+        while (! times_m.empty() && times_m.front() + span_m <= t) {
+          queue_m.pop(reducer_m);
+          times_m.pop_front();
+        }
+        return ops::result(reducer_m, queue_m.total(reducer_m));
+      }
+      ///
+      /// Adds a value observed now.
+      ///
+      template<typename T>
+      inline typename ops::view_type operator()(const T& x) {
+        return (*this)(clock_type::now(), x);
+      }
+    private:
+      clock_type::duration span_m;
+      Reducer reducer_m;
+      window_queue_t<reducer_type> queue_m;
+      std::deque<clock_type::time_point> times_m;
+    }; // timed_window_t
+    ///
+    /// Accumulates every value it is called with into a state of its
+    /// own. Threads that share a stream can each feed a sink of their
+    /// own and merge them at the end.
+    ///
+    template<typename Reducer>
+    class sink_t {
+      typedef typename std::decay<Reducer>::type reducer_type;
+      typedef reducer_ops<reducer_type> ops;
+    public:
+      inline sink_t(Reducer&& reducer)
+        : reducer_m(std::forward<Reducer>(reducer))
+        , state_m(ops::init(reducer_m))
+      {}
+      template<typename T>
+      inline void operator()(const T& x) {
+        ops::accumulate(reducer_m, state_m, x);
+      }
+      ///
+      /// Adds what another sink has seen, as if it came after what
+      /// this sink has seen.
+      ///
+      inline void merge(const sink_t& other) {
+        ops::merge(reducer_m, state_m, other.state_m);
+      }
+      inline typename ops::view_type result() const {
+        return ops::result(reducer_m, state_m);
+      }
+    private:
+      Reducer reducer_m;
+      typename ops::state_type state_m;
+    }; // sink_t
+    // ---------------------------------------------------------------------- //
+    /// \}
+  } // namespace funtup_helper
+
+  ///
+  /// Builds a functor that reduces a random access range with
+  /// <code>op</code>, starting from <code>identity</code>, in
+  /// parallel but with a result that is reproducible bit for bit
+  /// (see <code>funtup_helper::fold_t</code>). The operator should
+  /// be associative up to rounding, and <code>identity</code> should
+  /// leave any value unchanged when combined with it.
+  ///
+  /*!\code
+    auto total = pipe(parse_prices(), fold(std::plus<double>(), 0.0));
+    double t = total(input); // same bits no matter the thread count
+  \endcode*/
+  template<typename Op, typename T>
+  inline funtup_helper::fold_t<Op, T>
+  fold(Op&& op, T identity, std::size_t leaf = 4096) {
+    return funtup_helper::fold_t<Op, T>(std::forward<Op>(op), std::move(identity), leaf);
+  }
+
+  ///
+  /// Builds a functor that computes the inclusive prefix scan of a
+  /// random access range with <code>op</code>, in parallel blocks of
+  /// (at least) <code>grain</code> elements.
+  ///
+  /*!\code
+    auto running_max = scan([](int a, int b) { return std::max(a, b); });
+    std::vector<int> m = running_max(std::vector<int>{ 1, 3, 2, 5 }); // 1, 3, 3, 5
+  \endcode*/
+  template<typename Op>
+  inline funtup_helper::scan_t<Op>
+  scan(Op&& op, std::size_t grain = 4096) {
+    return funtup_helper::scan_t<Op>(std::forward<Op>(op), grain);
+  }
+
+  ///
+  /// \name Reducers
+  ///
+  /// Factories for the basic reducers (see
+  /// <code>funtup_helper::reducer_ops</code> for the protocol). Use a
+  /// battery to compute several aggregates in one pass.
+  ///
+  /// \{
+  // ------------------------------------------------------------------------ //
+  inline funtup_helper::count_t count_of() { return funtup_helper::count_t(); }
+  template<typename T>
+  inline funtup_helper::sum_t<T> sum_of() { return funtup_helper::sum_t<T>(); }
+  template<typename T>
+  inline funtup_helper::mean_t<T> mean_of() { return funtup_helper::mean_t<T>(); }
+  template<typename T>
+  inline funtup_helper::min_t<T> min_of() { return funtup_helper::min_t<T>(); }
+  template<typename T>
+  inline funtup_helper::max_t<T> max_of() { return funtup_helper::max_t<T>(); }
+  // ------------------------------------------------------------------------ //
+  /// \}
+
+  ///
+  /// Builds a reducer that keeps the <code>K</code> values of type
+  /// <code>T</code> with the highest <code>score_fn(value)</code>, in
+  /// O(K) memory.
+  ///
+  /*!\code
+    auto slowest = reduce(topk<100, request>([](const request& r) { return r.latency; }));
+    std::vector<request> worst = slowest(requests);
+  \endcode*/
+  template<std::size_t K, typename T, typename ScoreFn>
+  inline funtup_helper::topk_t<K, T, ScoreFn>
+  topk(ScoreFn score_fn) {
+    return funtup_helper::topk_t<K, T, ScoreFn>(std::move(score_fn));
+  }
+
+  ///
+  /// Builds a reducer that estimates the most frequent values of type
+  /// <code>T</code> in <code>capacity</code> counters (see
+  /// <code>funtup_helper::heavy_hitters_t</code>).
+  ///
+  template<typename T>
+  inline funtup_helper::heavy_hitters_t<T>
+  heavy_hitters(std::size_t capacity) {
+    return funtup_helper::heavy_hitters_t<T>(capacity);
+  }
+
+  ///
+  /// Builds a reducer that keeps a uniform sample of <code>K</code>
+  /// values of type <code>T</code> (see
+  /// <code>funtup_helper::reservoir_t</code>).
+  ///
+  template<std::size_t K, typename T>
+  inline funtup_helper::reservoir_t<K, T>
+  reservoir(std::uint64_t seed = 0x5eed) {
+    return funtup_helper::reservoir_t<K, T>(seed);
+  }
+
+  ///
+  /// Builds a functor that keeps a uniform sample of <code>K</code>
+  /// elements of a random access range per
+  /// <code>key_fn(element)</code>, in parallel.
+  ///
+  /*!\code
+    auto per_country = stratified_sample<100, request>([](const request& r) { return r.country; });
+    for (const auto& group : per_country(requests)) { inspect(group.first, group.second); }
+  \endcode*/
+  template<std::size_t K, typename T, typename KeyFn>
+  inline funtup_helper::group_by_t<KeyFn, funtup_helper::reservoir_t<K, T> >
+  stratified_sample(KeyFn&& key_fn, std::uint64_t seed = 0x5eed, std::size_t grain = 4096) {
+    return funtup_helper::group_by_t<KeyFn, funtup_helper::reservoir_t<K, T> >
+      (std::forward<KeyFn>(key_fn), funtup_helper::reservoir_t<K, T>(seed), grain, 4096);
+  }
+
+  ///
+  /// \name Sketches
+  ///
+  /// Factories for reducers that estimate aggregates in small,
+  /// mergeable summaries (see <code>funtup_helper</code> for the
+  /// error bounds).
+  ///
+  /*!\code
+    auto stats = reduce(battery(sum_of<double>(),
+                                quantiles_of<double>({ 0.5, 0.99 }),
+                                distinct_count_of<std::string>()));
+  \endcode*/
+  /// \{
+  // ------------------------------------------------------------------------ //
+  ///
+  /// The number of distinct values, estimated with HyperLogLog.
+  ///
+  template<typename T>
+  inline funtup_helper::distinct_count_t<T> distinct_count_of(int precision = 12) {
+    return funtup_helper::distinct_count_t<T>(precision);
+  }
+  ///
+  /// The quantiles <code>qs</code> (each in [0, 1]), estimated with a
+  /// t-digest.
+  ///
+  template<typename T>
+  inline funtup_helper::quantiles_t<T> quantiles_of(std::vector<double> qs, double compression = 100) {
+    return funtup_helper::quantiles_t<T>(std::move(qs), compression);
+  }
+  ///
+  /// A count-min sketch whose counts overestimate by at most
+  /// <code>epsilon</code> of the total with probability
+  /// <code>1 - delta</code>.
+  ///
+  template<typename T>
+  inline funtup_helper::count_min_t<T> count_min_of(double epsilon = 0.001, double delta = 0.01) {
+    return funtup_helper::count_min_t<T>(std::size_t(std::ceil(std::exp(1.0) / epsilon)),
+                                         std::size_t(std::ceil(std::log(1 / delta))));
+  }
+  // ------------------------------------------------------------------------ //
+  /// \}
+
+  ///
+  /// Builds a functor that reduces a random access range with a
+  /// reducer, in parallel chunks of (at least) <code>grain</code>
+  /// elements.
+  ///
+  /*!\code
+    auto stats = reduce(battery(sum_of<double>(), max_of<double>()));
+    std::tuple<double, double> r = stats(values);
+  \endcode*/
+  template<typename Reducer>
+  inline funtup_helper::reduce_t<Reducer>
+  reduce(Reducer&& reducer, std::size_t grain = 4096) {
+    return funtup_helper::reduce_t<Reducer>(std::forward<Reducer>(reducer), grain);
+  }
+
+  ///
+  /// Builds a functor that groups the elements of a random access
+  /// range by <code>key_fn</code> and reduces each group, returning a
+  /// vector of key and aggregate pairs in no particular order.
+  ///
+  /// The range is aggregated in parallel chunks of (at least)
+  /// <code>grain</code> elements into one hash map per thread, which
+  /// are merged by hash partition in parallel when there are more
+  /// than <code>partition_above</code> groups in total.
+  ///
+  /*!\code
+    auto per_user = group_by([](const event& e) { return e.user; },
+                             battery(count_of(), sum_of<double>()));
+    for (const auto& g : per_user(events)) {
+      std::cout << g.first << ": " << std::get<0>(g.second) << std::endl;
+    }
+  \endcode*/
+  template<typename KeyFn, typename Reducer>
+  inline funtup_helper::group_by_t<KeyFn, Reducer>
+  group_by(KeyFn&& key_fn, Reducer&& reducer, std::size_t grain = 4096, std::size_t partition_above = 4096) {
+    return funtup_helper::group_by_t<KeyFn, Reducer>(std::forward<KeyFn>(key_fn), std::forward<Reducer>(reducer), grain, partition_above);
+  }
+
+  ///
+  /// Builds a functor that applies <code>func</code> to every element
+  /// of a range and returns a vector of the results.
+  ///
+  template<typename Func>
+  inline funtup_helper::each_t<Func>
+  each(Func&& func) {
+    return funtup_helper::each_t<Func>(std::forward<Func>(func));
+  }
+
+  ///
+  /// Builds a functor that runs a state machine stage over a range,
+  /// interleaving <code>group</code> elements at a time to hide cache
+  /// misses (see <code>funtup_helper::interleave_t</code> for what the
+  /// stage needs to provide).
+  ///
+  /*!\code
+    struct tree_lookup {
+      struct state_type { const node* at; int key; };
+      const void* start(state_type& s, int key) const { s.at = root; s.key = key; return s.at; }
+      const void* step(state_type& s) const {
+        if (s.at->key == s.key) { return nullptr; }
+        s.at = s.key < s.at->key ? s.at->left : s.at->right;
+        return s.at;
+      }
+      const node* result(const state_type& s) const { return s.at; }
+    };
+    auto found = interleave(tree_lookup{ root }, 16)(keys);
+  \endcode*/
+  template<typename Stage>
+  inline funtup_helper::interleave_t<Stage>
+  interleave(Stage&& stage, std::size_t group = 16) {
+    return funtup_helper::interleave_t<Stage>(std::forward<Stage>(stage), group);
+  }
+
+  ///
+  /// Builds a functor that hash joins a range of probe rows against
+  /// the rows in <code>build</code>, matching
+  /// <code>build_key(b) == probe_key(p)</code>, and returns a vector
+  /// of <code>std::tuple(b, p)</code>, ready for
+  /// <code>auto_unpack</code>.
+  ///
+  /*!\code
+    auto enriched = pipe(parse_events(),
+                         join(users, [](const user& u) { return u.id; },
+                                     [](const event& e) { return e.user_id; }),
+                         each(auto_unpack([](const user& u, const event& e) { ... })));
+  \endcode*/
+  template<typename Range, typename BuildKey, typename ProbeKey>
+  inline funtup_helper::join_t<typename funtup_helper::range_value<Range>::type, BuildKey, ProbeKey>
+  join(const Range& build, BuildKey&& build_key, ProbeKey&& probe_key) {
+    return funtup_helper::join_t<typename funtup_helper::range_value<Range>::type, BuildKey, ProbeKey>
+      (build, std::forward<BuildKey>(build_key), std::forward<ProbeKey>(probe_key));
+  }
+
+  ///
+  /// Builds a functor that sorts a random access range of trivially
+  /// copyable elements by <code>key_fn(element)</code>, stably,
+  /// using about <code>memory_budget</code> bytes and spilling sorted
+  /// runs to temporary files beyond that. The result is a single pass
+  /// input range that merges the runs as it is read.
+  ///
+  /*!\code
+    auto sorted = sort_by([](const record& r) { return r.timestamp; }, std::size_t(1) << 30);
+    for (const record& r : sorted(records)) { sessionize(r); }
+  \endcode*/
+  template<typename KeyFn>
+  inline funtup_helper::sort_by_t<KeyFn>
+  sort_by(KeyFn&& key_fn, std::size_t memory_budget, std::size_t grain = 4096) {
+    return funtup_helper::sort_by_t<KeyFn>(std::forward<KeyFn>(key_fn), memory_budget, grain);
+  }
+
+  ///
+  /// Builds a stateful functor that, every time it is called with a
+  /// value, returns the aggregate of the last <code>N</code> values.
+  ///
+  /// Each call costs O(1) amortized: reducers that can unaccumulate
+  /// or unmerge keep a running aggregate that values are taken out of
+  /// as they leave the window, and others use a pair of stacks of
+  /// partial aggregates. The latter copies a state per value, which
+  /// is expensive for large summaries such as
+  /// <code>heavy_hitters</code> or the sketches other than
+  /// <code>count_min_of</code>. Results that are references (such as
+  /// the count-min sketch) refer to the window, and change with the
+  /// next call.
+  ///
+  /*!\code
+    auto w = window<100>(battery(mean_of<double>(), max_of<double>(), count_of()));
+    for (double latency : events) {
+      std::tuple<double, double, std::size_t> stats = w(latency);
+    }
+  \endcode*/
+  template<std::size_t N, typename Reducer>
+  inline funtup_helper::window_t<N, Reducer>
+  window(Reducer&& reducer) {
+    return funtup_helper::window_t<N, Reducer>(std::forward<Reducer>(reducer));
+  }
+
+  ///
+  /// Builds a stateful functor that, every time it is called with a
+  /// value, returns the aggregate of the values from the last
+  /// <code>span</code> of time, in O(1) amortized per call.
+  ///
+  template<typename Rep, typename Period, typename Reducer>
+  inline funtup_helper::timed_window_t<Reducer>
+  window_for(std::chrono::duration<Rep, Period> span, Reducer&& reducer) {
+    return funtup_helper::timed_window_t<Reducer>
+      (std::chrono::duration_cast<std::chrono::steady_clock::duration>(span), std::forward<Reducer>(reducer));
+  }
+  ///
+  /// Builds a stateful functor that accumulates the values of a stream
+  /// with a reducer; the aggregate is available from
+  /// <code>result()</code>.
+  ///
+  /*!\code
+    auto top = sink(heavy_hitters<std::string>(1000));
+    for (const std::string& word : stream) { top(word); }
+    auto frequent = top.result();
+  \endcode*/
+  template<typename Reducer>
+  inline funtup_helper::sink_t<Reducer>
+  sink(Reducer&& reducer) {
+    return funtup_helper::sink_t<Reducer>(std::forward<Reducer>(reducer));
+  }
+  ///
+  /// Builds a stateful functor that samples each element of a range
+  /// (or, through <code>next()</code>, a stream) with probability
+  /// <code>rate</code>.
+  ///
+  /*!\code
+    auto traced = pipe(sample(0.001), each(trace()));
+  \endcode*/
+  inline funtup_helper::sample_t sample(double rate, std::uint64_t seed = 0x5eed) {
+    return funtup_helper::sample_t(rate, seed);
+  }
+
+} // namespace funtup
+} // namespace com_masaers
+
+#endif
@@ -0,0 +1,305 @@
+#include "funtup_range.hpp"
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+
+struct parse { std::vector<double> operator()(int n) const {
+  std::vector<double> result;
+  for (int i = 0; i < n; ++i) { result.push_back(1.0 / (i + 1)); }
+  return result;
+} };
+
+struct user { int id; std::string name; };
+struct event { int user_id; int value; };
+struct describe {
+  std::string operator()(const user& u, const event& e) const {
+    return u.name + ":" + std::to_string(e.value);
+  }
+};
+
+// Binary search written as a state machine for interleave.
+struct lower_bound_sm {
+  const std::vector<int>* sorted;
+  struct state_type { std::size_t lo, hi; int key; };
+  const void* start(state_type& s, int key) const {
+    s.lo = 0;
+    s.hi = sorted->size();
+    s.key = key;
+    return s.lo < s.hi ? &(*sorted)[(s.lo + s.hi) / 2] : nullptr;
+  }
+  const void* step(state_type& s) const {
+    const std::size_t mid = (s.lo + s.hi) / 2;
+    if ((*sorted)[mid] < s.key) { s.lo = mid + 1; } else { s.hi = mid; }
+    return s.lo < s.hi ? &(*sorted)[(s.lo + s.hi) / 2] : nullptr;
+  }
+  std::size_t result(const state_type& s) const { return s.lo; }
+};
+
+// A lookup that counts how often it is asked to prefetch.
+struct counted_lookup {
+  const std::vector<int>* table;
+  std::size_t* prefetches;
+  void prefetch(int i) const { ++*prefetches; }
+  int operator()(int i) const { return (*table)[i]; }
+};
+
+struct add1 { int operator()(int a) const { return a + 1; } };
+
+struct record {
+  int key;
+  int seq;
+}; // record
+
+int main(int argc, char** argv) {
+  using namespace com_masaers::funtup;
+  using namespace std;
+  
+  vector<long> ints;
+  for (long i = 1; i <= 100000; ++i) { ints.push_back(i); }
+  auto sum = fold(plus<long>(), 0L, 1000);
+  assert(sum(ints) == 100000L * 100001L / 2);
+  assert(sum(vector<long>()) == 0);
+  assert(fold(plus<long>(), 0L)(vector<long>(3, 2)) == 6);
+  
+  auto harmonic = pipe(parse(), fold(plus<double>(), 0.0, 1000));
+  max_threads() = 1;
+  const double h1 = harmonic(100000);
+  max_threads() = 3;
+  const double h3 = harmonic(100000);
+  assert(memcmp(&h1, &h3, sizeof(double)) == 0);
+  
+  auto running = scan(plus<long>(), 1000);
+  vector<long> expected(ints.size());
+  partial_sum(ints.begin(), ints.end(), expected.begin());
+  vector<long> scanned = running(ints);
+  assert(scanned == expected);
+  ints.resize(4097);
+  expected.resize(4097);
+  running.call_into(scanned, ints);
+  assert(scanned == expected);
+  auto running_max = scan([](int a, int b) { return a < b ? b : a; });
+  assert(running_max(vector<int>{ 1, 3, 2, 5 }) == (vector<int>{ 1, 3, 3, 5 }));
+  assert(running_max(vector<int>()).empty());
+  
+  auto w = window<3>(battery(mean_of<double>(), max_of<double>(), count_of()));
+  const double latencies[] = { 4, 8, 6, 1, 2, 3 };
+  const double means[] = { 4, 6, 6, 5, 3, 2 };
+  const double maxes[] = { 4, 8, 8, 8, 6, 3 };
+  for (int i = 0; i < 6; ++i) {
+    auto stats = w(latencies[i]);
+    assert(get<0>(stats) == means[i] && get<1>(stats) == maxes[i]);
+    assert(get<2>(stats) == (i < 3 ? size_t(i + 1) : 3));
+  }
+  auto wsum = pipe(add1(), window<2>(sum_of<int>()));
+  assert(wsum(1) == 2 && wsum(2) == 5 && wsum(3) == 7);
+  auto wt = window_for(chrono::seconds(10), battery(sum_of<int>(), min_of<int>()));
+  const chrono::steady_clock::time_point t0;
+  assert(wt(t0, 5) == make_tuple(5, 5));
+  assert(wt(t0 + chrono::seconds(5), 7) == make_tuple(12, 5));
+  assert(wt(t0 + chrono::seconds(10), 9) == make_tuple(16, 7));
+  assert(wt(t0 + chrono::seconds(30), 1) == make_tuple(1, 1));
+  assert(wt(t0 + chrono::seconds(29), 4) == make_tuple(5, 1));
+  auto instant = window_for(chrono::seconds(0), sum_of<int>());
+  assert(instant(t0, 1) == 0 && instant(t0, 2) == 0 && instant(t0 + chrono::seconds(1), 3) == 0);
+  
+  vector<int> events;
+  for (int i = 0; i < 100000; ++i) { events.push_back(i); }
+  max_threads() = 3;
+  assert(reduce(battery(sum_of<long>(), max_of<int>(), count_of()), 1000)(events)
+         == make_tuple(4999950000L, 99999, size_t(100000)));
+  for (int groups : { 10, 20000 }) {
+    auto g = group_by([groups](int x) { return x % groups; }, battery(sum_of<long>(), count_of()), 1000, 1000);
+    map<int, tuple<long, size_t> > expected_groups;
+    for (int x : events) {
+      get<0>(expected_groups[x % groups]) += x;
+      get<1>(expected_groups[x % groups]) += 1;
+    }
+    auto grouped = g(events);
+    assert(grouped.size() == size_t(groups));
+    for (const auto& kv : grouped) {
+      assert(expected_groups[kv.first] == kv.second);
+    }
+  }
+  
+  const vector<user> users = { { 1, "ann" }, { 2, "bob" }, { 1, "amy" } };
+  vector<event> probes;
+  for (int i = 0; i < 40; ++i) { probes.push_back(event{ i % 4, i }); }
+  auto enrich = pipe(join(users, [](const user& u) { return u.id; },
+                                 [](const event& e) { return e.user_id; }),
+                     each(auto_unpack(describe())));
+  vector<string> described = enrich(probes);
+  assert(described.size() == 30);
+  assert(described[0] == "ann:1" && described[1] == "amy:1" && described[2] == "bob:2");
+  assert(described[29] == "bob:38");
+  
+  vector<int> sorted;
+  for (int i = 0; i < 5000; ++i) { sorted.push_back(3 * i); }
+  vector<int> keys;
+  for (int i = 0; i < 1000; ++i) { keys.push_back((i * 7919) % 16000 - 100); }
+  for (size_t group : { 1, 3, 16 }) {
+    auto found = interleave(lower_bound_sm{ &sorted }, group)(keys);
+    assert(found.size() == keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      assert(found[i] == size_t(lower_bound(sorted.begin(), sorted.end(), keys[i]) - sorted.begin()));
+    }
+  }
+  assert(interleave(lower_bound_sm{ &sorted })(vector<int>()).empty());
+  
+  size_t prefetches = 0;
+  auto lookup = each(counted_lookup{ &sorted, &prefetches });
+  assert(lookup.lookahead() == 0);
+  vector<int> indices;
+  for (int i = 0; i < 5000; ++i) { indices.push_back((i * 31) % 5000); }
+  vector<int> looked_up = lookup(indices);
+  for (size_t i = 0; i < indices.size(); ++i) {
+    assert(looked_up[i] == 3 * indices[i]);
+  }
+  assert(prefetches > 4000 && prefetches < 5000);
+  const size_t tuned = lookup.lookahead();
+  assert(tuned >= 1 && tuned <= 64 && (tuned & (tuned - 1)) == 0);
+  auto copied = lookup;
+  lookup(indices);
+  assert(lookup.lookahead() == tuned && copied.lookahead() == tuned);
+  prefetches = 0;
+  assert(lookup(vector<int>{ 1, 2 }) == (vector<int>{ 3, 6 }) && prefetches == 0);
+  
+  vector<int> scored;
+  for (int i = 0; i < 20000; ++i) { scored.push_back((i * 7919) % 20011); }
+  auto largest = reduce(topk<5, int>([](int x) { return -abs(x - 10000); }), 1000);
+  vector<int> close = largest(scored);
+  assert(close.size() == 5 && close.front() == 10000);
+  for (int x : close) { assert(abs(x - 10000) <= 2); }
+  assert(reduce(topk<5, int>([](int x) { return x; }))(vector<int>{ 3, 1, 2 }) == (vector<int>{ 3, 2, 1 }));
+  
+  vector<int> skewed;
+  map<int, size_t> truth;
+  for (int i = 0; i < 30000; ++i) {
+    const int x = i % 3 == 0 ? i % 4 : i % 2000;
+    skewed.push_back(x);
+    ++truth[x];
+  }
+  auto frequent = reduce(heavy_hitters<int>(50), 4096)(skewed);
+  assert(frequent.size() == 50);
+  for (size_t i = 0; i < 4; ++i) {
+    assert(frequent[i].first < 4);
+    assert(frequent[i].second >= truth[frequent[i].first]);
+    assert(frequent[i].second <= truth[frequent[i].first] + skewed.size() / 50);
+  }
+  
+  auto left = sink(battery(count_of(), heavy_hitters<int>(8)));
+  auto right = left;
+  for (int i = 0; i < 100; ++i) { (i < 60 ? left : right)(i % 3 == 0 ? 7 : i); }
+  left.merge(right);
+  assert(get<0>(left.result()) == 100);
+  assert(get<1>(left.result()).front().first == 7 && get<1>(left.result()).front().second >= 34);
+  
+  vector<double> uniform;
+  for (int i = 0; i < 100000; ++i) { uniform.push_back(double((i * 7919) % 100000)); }
+  auto sketched = reduce(battery(sum_of<double>(),
+                                 quantiles_of<double>({ 0.0, 0.01, 0.5, 0.99, 1.0 }),
+                                 distinct_count_of<double>(),
+                                 count_min_of<double>(0.001, 0.01)), 4096)(uniform);
+  assert(get<0>(sketched) == 4999950000.0);
+  const vector<double>& qs = get<1>(sketched);
+  assert(qs[0] == 0 && qs[4] == 99999);
+  assert(abs(qs[1] - 1000) < 100 && abs(qs[2] - 50000) < 1000 && abs(qs[3] - 99000) < 100);
+  assert(abs(get<2>(sketched) - 100000) < 100000 * 0.05);
+  assert(get<3>(sketched).count(42.0) >= 1 && get<3>(sketched).count(42.0) <= 1 + 100000 * 0.001 * 3);
+  assert(get<3>(sketched).total() == 100000);
+  assert(reduce(distinct_count_of<int>())(vector<int>{ 1, 2, 2, 3, 3, 3 }) > 2.9);
+  assert(std::isnan(reduce(quantiles_of<int>({ 0.5 }))(vector<int>()).front()));
+  
+  auto recent = window<10>(count_min_of<int>(0.01, 0.01));
+  for (int i = 0; i < 100; ++i) { recent(i % 20 < 10 ? 1 : 2); }
+  assert(recent(3).count(2) == 9 && recent(3).count(1) == 0);
+  auto recent_pair = window<10>(battery(count_min_of<int>(0.01, 0.01), count_min_of<int>(0.1, 0.1)));
+  for (int i = 0; i < 100; ++i) { recent_pair(i % 20 < 10 ? 1 : 2); }
+  assert(get<0>(recent_pair(3)).count(2) == 9 && get<1>(recent_pair(3)).total() == 10);
+  
+  vector<int> population(100000);
+  iota(population.begin(), population.end(), 0);
+  auto tenth = sample(0.1);
+  vector<int> sampled = tenth(vector<int>(population.begin(), population.begin() + 50000));
+  vector<int> more = tenth(vector<int>(population.begin() + 50000, population.end()));
+  assert(is_sorted(sampled.begin(), sampled.end()) && (more.empty() || more.front() >= 50000));
+  assert(sampled.size() + more.size() > 9400 && sampled.size() + more.size() < 10600);
+  assert(sample(1)(population) == population && sample(0)(population).empty());
+  size_t taken = 0;
+  auto every_other = sample(0.5);
+  for (int i = 0; i < 10000; ++i) { taken += every_other.next(); }
+  assert(taken > 4700 && taken < 5300);
+  
+  double mean = 0;
+  for (int run = 0; run < 20; ++run) {
+    vector<int> kept = reduce(reservoir<100, int>(run), 1000)(population);
+    assert(kept.size() == 100);
+    set<int> unique(kept.begin(), kept.end());
+    assert(unique.size() == 100 && *unique.begin() >= 0 && *unique.rbegin() < 100000);
+    mean += accumulate(kept.begin(), kept.end(), 0.0) / 2000;
+  }
+  assert(abs(mean - 50000) < 3000);
+  assert(reduce(reservoir<100, int>())(vector<int>{ 3, 1, 2 }).size() == 3);
+  assert(reduce(reservoir<100, int>(), 1000)(population) == reduce(reservoir<100, int>(), 1000)(population));
+  
+  auto strata = stratified_sample<5, int>([](int x) { return x % 3; }, 7, 1000)(population);
+  assert(strata.size() == 3);
+  for (const auto& stratum : strata) {
+    assert(stratum.second.size() == 5);
+    for (int x : stratum.second) { assert(x % 3 == stratum.first); }
+  }
+  auto again = stratified_sample<5, int>([](int x) { return x % 3; }, 7, 1000)(population);
+  sort(strata.begin(), strata.end());
+  sort(again.begin(), again.end());
+  assert(strata == again);
+  
+  vector<record> records;
+  for (int i = 0; i < 30000; ++i) { records.push_back(record{ (i * 7919) % 1000, i }); }
+  vector<record> by_hand(records);
+  stable_sort(by_hand.begin(), by_hand.end(), [](const record& a, const record& b) { return a.key < b.key; });
+  for (size_t budget : { size_t(1) << 20, size_t(8000), size_t(2400) }) {
+    auto by_key = sort_by([](const record& r) { return r.key; }, budget, 1000);
+    auto merged = by_key(records);
+    size_t i = 0;
+    for (const record& r : merged) {
+      assert(r.key == by_hand[i].key && r.seq == by_hand[i].seq);
+      ++i;
+    }
+    assert(i == by_hand.size());
+  }
+  vector<int> keys_in_order = pipe(sort_by([](const record& r) { return r.key; }, 8000, 1000),
+                                   each([](const record& r) { return r.key; }))(records);
+  assert(keys_in_order.size() == records.size() && is_sorted(keys_in_order.begin(), keys_in_order.end()));
+  vector<int> record_keys;
+  for (const record& r : records) { record_keys.push_back(r.key); }
+  vector<int> sorted_keys(record_keys);
+  sort(sorted_keys.begin(), sorted_keys.end());
+  for (size_t budget : { size_t(1) << 20, size_t(2400) }) {
+    assert(pipe(sort_by([](int x) { return x; }, budget, 1000), reduce(sum_of<long>(), 1000))(record_keys)
+           == accumulate(record_keys.begin(), record_keys.end(), 0L));
+    auto tens = pipe(sort_by([](int x) { return x; }, budget, 1000),
+                     group_by([](int x) { return x % 10; }, count_of(), 1000))(record_keys);
+    assert(tens.size() == 10);
+    for (const auto& ten : tens) { assert(ten.second == 3000); }
+    assert(pipe(sort_by([](int x) { return x; }, budget, 1000), fold(plus<long>(), 0L, 64))(record_keys)
+           == fold(plus<long>(), 0L, 64)(sorted_keys));
+    assert(pipe(sort_by([](int x) { return x; }, budget, 1000), scan([](int a, int b) { return max(a, b); }, 1000))(record_keys)
+           == sorted_keys);
+    assert(pipe(sort_by([](int x) { return x; }, budget, 1000), interleave(lower_bound_sm{ &sorted }, 16))(record_keys)
+           == interleave(lower_bound_sm{ &sorted }, 16)(sorted_keys));
+    assert(pipe(sort_by([](int x) { return x; }, budget, 1000), sample(0.1, 7))(record_keys) == sample(0.1, 7)(sorted_keys));
+  }
+  auto nothing = sort_by([](int x) { return x; }, 64)(vector<int>());
+  assert(nothing.begin() == nothing.end());
+  
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include "funtup.hpp"
 #include <cassert>
+#include <algorithm>
+#include <vector>
 
 
 
@@ -7,6 +9,18 @@ struct add3 { int operator()(int a) const { return a + 3; } };
 struct mul3 { int operator()(int a) const { return a * 3; } };
 struct add { int operator()(int a, int b) const { return a + b; } };
 struct mul { int operator()(int a, int b) const { return a * b; } };
+struct above { int t; bool operator()(int a) const { return a > t; } };
+struct iota {
+  std::vector<int> operator()(int n) const {
+    std::vector<int> result;
+    call_into(result, n);
+    return result;
+  }
+  void call_into(std::vector<int>& result, int n) const {
+    result.clear();
+    for (int i = 0; i < n; ++i) { result.push_back(i); }
+  }
+};
 
 std::tuple<int, int> divint(int a, int b) {
   return std::make_tuple(a / b, a % b);
@@ -26,6 +40,50 @@ int main(int argc, char** argv) {
   assert(get<0>(r) == 7);
   assert(get<1>(r) == 12);
 
+  auto m = b.call_masked(0x2, 3, 4);
+  assert(! get<0>(m) && get<1>(m) && *get<1>(m) == 12);
+  int calls = 0;
+  auto count_calls = [&calls](int, int) { ++calls; };
+  auto bv = battery(add(), count_calls, mul());
+  auto mv = bv.call_masked(bitset<3>("011"), 3, 4);
+  assert(calls == 1 && *get<0>(mv) == 7 && ! get<2>(mv));
+  
+  auto ab0 = anytime_battery(deferrable(1, mul()), required(add()), deferrable(2, count_calls));
+  calls = 0;
+  auto far = chrono::steady_clock::now() + chrono::hours(1);
+  auto r0 = ab0(far, 3, 4);
+  assert(*get<0>(r0) == 12 && *get<1>(r0) == 7 && get<2>(r0) && calls == 1);
+  auto r1 = ab0(chrono::steady_clock::time_point(), 3, 4);
+  assert(! get<0>(r1) && *get<1>(r1) == 7 && ! get<2>(r1) && calls == 1);
+  
+  bool cold = true;
+  auto slow = [](int x) { this_thread::sleep_for(chrono::milliseconds(10)); return x; };
+  auto once_slow = [&cold](int x) { if (cold) { this_thread::sleep_for(chrono::milliseconds(10)); cold = false; } return x; };
+  auto ab1 = anytime_battery(required(add3()), deferrable(1, once_slow));
+  auto tight = [] { return chrono::steady_clock::now() + chrono::milliseconds(3); };
+  assert(get<1>(ab1(tight(), 1)));
+  assert(ab1.expected_cost(1) >= chrono::milliseconds(10));
+  assert(! get<1>(ab1(tight(), 1)));
+  int skipped = 1;
+  while (! get<1>(ab1(tight(), 1))) { ++skipped; }
+  assert(skipped >= 5 && skipped < 30);
+  for (int i = 0; i < 10; ++i) { assert(get<1>(ab1(tight(), 1))); }
+  auto ab2 = anytime_battery(deferrable(1, slow, chrono::milliseconds(20)));
+  assert(! get<0>(ab2(tight(), 1)) && ab2.expected_cost(0) < chrono::milliseconds(20));
+  
+  calls = 0;
+  auto rc = bv.call_compact(3, 4);
+  static_assert(tuple_size<decltype(rc)::tuple_type>::value == 2, "void results should be dropped");
+  assert(calls == 1 && get<0>(rc) == 7 && get<1>(rc) == 12);
+  assert(get_member<0>(rc) == 7 && get_member<2>(rc) == 12);
+  
+  auto bi = battery(iota(), add3(), battery(iota(), mul3()));
+  auto ri = bi(8);
+  const int* ri_data = get<0>(ri).data();
+  bi.call_into(ri, 4);
+  assert(get<0>(ri).size() == 4 && get<0>(ri).data() == ri_data);
+  assert(get<1>(ri) == 7 && get<0>(get<2>(ri)).size() == 4 && get<1>(get<2>(ri)) == 12);
+  
   auto a = auto_unpack(add());
   assert(a(make_tuple(2, 1)) == 3);
   
@@ -35,6 +93,52 @@ int main(int argc, char** argv) {
   auto c3 = compose(auto_unpack(add()), &divint);
   assert(c3(5, 2) == 3);
   
+  auto p4 = pipe(fn<decltype(&divint), &divint>(), auto_unpack(add()));
+  assert(p4(5, 2) == 3);
+  static_assert(is_empty<decltype(COM_MASAERS_FUNTUP_FN(&divint))>::value,
+                "compile time functions should be stateless");
+  auto c4 = compose(auto_unpack(add()), COM_MASAERS_FUNTUP_FN(&divint));
+  assert(c4(5, 2) == 3);
+  const int k = 3;
+  auto p4b = pipe(COM_MASAERS_FUNTUP_FN(&divint), [k](const tuple<int, int>& t) { return get<0>(t) + k; });
+  static_assert(sizeof(p4b) == sizeof(int), "compile time functions should take no space in a pipe");
+  assert(p4b(5, 2) == 5);
+  
+  add3 a3;
+  auto p5 = pipe(a3, mul3(), a3);
+  assert(p5(2) == 18);
+  
+  auto ab = array_battery(above{1}, above{5}, above{10});
+  auto ar = ab(6);
+  assert(ar[0] && ar[1] && ! ar[2]);
+  array<above, 64> thresholds;
+  for (int i = 0; i < 64; ++i) { thresholds[i].t = i; }
+  auto ab64 = array_battery(thresholds);
+  auto ar64 = ab64(32);
+  assert(ar64[31] && ! ar64[32]);
+  
+  max_threads() = 4;
+  vector<above> rules;
+  for (int i = 0; i < 10000; ++i) { rules.push_back(above{i}); }
+  auto db = dynamic_battery(rules, 1000);
+  vector<char> fired;
+  db.call_into(fired, 5000);
+  assert(fired.size() == 10000);
+  assert(count(fired.begin(), fired.end(), 1) == 5000);
+  assert(fired[4999] && ! fired[5000]);
+  static_assert(is_same<decltype(db(1)), vector<char> >::value, "bool results are kept as char");
+  assert(db(5000) == fired);
+  vector<bool> packed;
+  db.call_into(packed, 5000);
+  assert(packed.size() == 10000 && packed[4999] && ! packed[5000]);
+  auto small = dynamic_battery(vector<above>(rules.begin(), rules.begin() + 10));
+  auto sr = small(5);
+  assert(sr.size() == 10 && sr[4] && ! sr[5]);
+  bool thrown = false;
+  auto picky = dynamic_battery(vector<function<int(int)> >(10000, [](int x) { return x > 0 ? x : throw x; }), 64);
+  try { picky(0); } catch (int) { thrown = true; }
+  assert(thrown && picky(2).size() == 10000 && picky(2)[9999] == 2);
+  
   return 0;
 }
 
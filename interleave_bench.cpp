@@ -0,0 +1,53 @@
+///
+/// \file
+///
+/// \brief Run-time benchmark for interleaved state machine stages.
+///
+/// Runs <code>2^20</code> binary searches over a sorted array of
+/// <code>2^25</code> ints (128 MB, far more than fits in cache) with
+/// <code>interleave</code> at a few group sizes, and prints how long
+/// each took. A group of one runs the searches one after the other,
+/// so it is the baseline.
+///
+#include "funtup_range.hpp"
+#include <cstdio>
+#include <vector>
+#include <chrono>
+
+// Binary search written as a state machine for interleave.
+struct lower_bound_sm {
+  const std::vector<int>* sorted;
+  struct state_type { std::size_t lo, hi; int key; };
+  const void* start(state_type& s, int key) const {
+    s.lo = 0;
+    s.hi = sorted->size();
+    s.key = key;
+    return s.lo < s.hi ? &(*sorted)[(s.lo + s.hi) / 2] : nullptr;
+  }
+  const void* step(state_type& s) const {
+    const std::size_t mid = (s.lo + s.hi) / 2;
+    if ((*sorted)[mid] < s.key) { s.lo = mid + 1; } else { s.hi = mid; }
+    return s.lo < s.hi ? &(*sorted)[(s.lo + s.hi) / 2] : nullptr;
+  }
+  std::size_t result(const state_type& s) const { return s.lo; }
+};
+
+int main(int argc, char** argv) {
+  using namespace com_masaers::funtup;
+  std::vector<int> sorted(std::size_t(1) << 25);
+  for (std::size_t i = 0; i < sorted.size(); ++i) { sorted[i] = int(2 * i); }
+  std::vector<int> keys(std::size_t(1) << 20);
+  std::uint64_t random = 42;
+  for (int& key : keys) { key = int(funtup_helper::split_mix(random) % (2 * sorted.size())); }
+  std::size_t check = 0;
+  for (std::size_t group : { 1, 4, 16, 32 }) {
+    auto search = interleave(lower_bound_sm{ &sorted }, group);
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<std::size_t> found = search(keys);
+    const auto end = std::chrono::steady_clock::now();
+    check += found.back();
+    std::printf("interleave group %zu: %lld ms\n", group,
+                (long long)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+  }
+  return check == 4 * ((std::size_t(keys.back()) + 1) / 2) ? 0 : 1;
+}
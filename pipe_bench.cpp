@@ -0,0 +1,30 @@
+///
+/// \file
+///
+/// \brief Build-time benchmark for long pipes and compositions.
+///
+/// Compile with <code>-DFUNTUP_BENCH_STAGES=N</code> to get a pipe and
+/// a composition of <code>N</code> distinct stages each. The
+/// interesting measure is how long the compiler takes, which is what
+/// <code>make bench</code> records.
+///
+#include "funtup.hpp"
+
+#ifndef FUNTUP_BENCH_STAGES
+#define FUNTUP_BENCH_STAGES 10
+#endif
+
+template<int I> struct inc { int operator()(int a) const { return a + 1; } };
+
+template<int... I>
+int run(com_masaers::funtup::seq<I...>) {
+  using namespace com_masaers::funtup;
+  auto p = pipe(inc<I>()...);
+  auto c = compose(inc<I>()...);
+  return p(0) + c(0);
+}
+
+int main(int argc, char** argv) {
+  using namespace com_masaers::funtup;
+  return run(gen_seq<FUNTUP_BENCH_STAGES>::type()) == 2 * FUNTUP_BENCH_STAGES ? 0 : 1;
+}